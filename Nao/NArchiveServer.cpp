@@ -0,0 +1,329 @@
+#include "NArchiveServer.h"
+#include "NTrace.h"
+
+#include <QTcpSocket>
+#include <QRunnable>
+#include <QThread>
+#include <QElapsedTimer>
+
+// decoded blocks we keep around
+
+static const int BlockCacheBytes = 128 << 20;
+
+// compressed entries up to NEntryReader::BufferLimit are decoded whole, once, and kept
+// here. a few of them, so a client reading two files side by side doesn't thrash
+
+static const int EntryCacheBytes = static_cast<int>(2 * NEntryReader::BufferLimit);
+
+// larger ones cost the same to decode however much of them we keep, so we keep up to
+// this much of one from the requested block on
+
+static const qint64 DecodedEntryBytes = BlockCacheBytes / 4;
+
+static const int MaxRequestSize = 16 << 10;
+static const int SocketTimeout = 30000;
+static const qint64 SendBuffer = 1 << 20;
+
+// how often a waiting connection checks whether the server is going away
+
+static const int StopPollMs = 100;
+
+namespace {
+
+    // one blocking connection per pool thread, closed after a single response
+
+    class NServerConnection : public QRunnable {
+        public:
+            NServerConnection(NArchiveServer* server, qintptr descriptor)
+                : server(server), descriptor(descriptor) {
+
+            }
+
+            void run() override {
+                QTcpSocket socket;
+
+                if (!socket.setSocketDescriptor(descriptor))
+                    return;
+
+                QByteArray request;
+
+                while (!request.contains("\r\n\r\n")) {
+                    if (request.size() > MaxRequestSize || !waitForReadyRead(socket))
+                        return;
+
+                    request += socket.readAll();
+                }
+
+                respond(socket, request.left(request.indexOf("\r\n\r\n")));
+
+                while (socket.bytesToWrite() > 0 && waitForBytesWritten(socket)) {}
+
+                socket.disconnectFromHost();
+
+                if (socket.state() != QAbstractSocket::UnconnectedState)
+                    waitFor(socket, [&](int ms) { return socket.waitForDisconnected(ms); });
+            }
+
+        private:
+
+            // up to SocketTimeout, but in short slices so a stopping server doesn't have to
+            // sit out a stalled client. the socket is aborted when run() returns
+
+            template <typename Wait>
+            bool waitFor(QTcpSocket& socket, Wait wait) {
+                QElapsedTimer timer;
+                timer.start();
+
+                while (!server->isStopping() && timer.elapsed() < SocketTimeout) {
+                    if (wait(StopPollMs))
+                        return true;
+
+                    if (socket.error() != QAbstractSocket::SocketTimeoutError)
+                        return false;
+                }
+
+                return false;
+            }
+
+            bool waitForReadyRead(QTcpSocket& socket) {
+                return waitFor(socket, [&](int ms) { return socket.waitForReadyRead(ms); });
+            }
+
+            bool waitForBytesWritten(QTcpSocket& socket) {
+                return waitFor(socket, [&](int ms) { return socket.waitForBytesWritten(ms); });
+            }
+
+            void respond(QTcpSocket& socket, const QByteArray& request) {
+                QList<QByteArray> lines = request.split('\n');
+                QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+
+                if (requestLine.size() < 2) {
+                    status(socket, "400 Bad Request");
+                    return;
+                }
+
+                bool head = (requestLine.at(0) == "HEAD");
+
+                if (!head && requestLine.at(0) != "GET") {
+                    status(socket, "405 Method Not Allowed");
+                    return;
+                }
+
+                QByteArray target = requestLine.at(1);
+
+                if (target.contains('?'))
+                    target.truncate(target.indexOf('?'));
+
+                QString path = QUrl::fromPercentEncoding(target).mid(1);
+
+                if (path.isEmpty()) {
+                    status(socket, "200 OK", server->listing(), head);
+                    return;
+                }
+
+                qint64 index = server->indexOf(path);
+
+                if (index < 0) {
+                    status(socket, "404 Not Found");
+                    return;
+                }
+
+                qint64 size = server->entrySize(index);
+                qint64 begin = 0;
+                qint64 end = size - 1;
+                bool partial = false;
+
+                for (const QByteArray& line : lines) {
+                    if (!line.toLower().startsWith("range:"))
+                        continue;
+
+                    // only single ranges: bytes=a-b, bytes=a- and bytes=-n
+
+                    QByteArray spec = line.mid(6).trimmed();
+
+                    if (!spec.startsWith("bytes=") || spec.contains(',') || !spec.contains('-')) {
+                        status(socket, "416 Range Not Satisfiable");
+                        return;
+                    }
+
+                    spec = spec.mid(6);
+
+                    QByteArray first = spec.left(spec.indexOf('-')).trimmed();
+                    QByteArray last = spec.mid(spec.indexOf('-') + 1).trimmed();
+
+                    if (first.isEmpty()) {
+                        begin = qMax(0LL, size - last.toLongLong());
+                    } else {
+                        begin = first.toLongLong();
+
+                        if (!last.isEmpty())
+                            end = qMin(end, last.toLongLong());
+                    }
+
+                    if (begin >= size || begin > end) {
+                        status(socket, "416 Range Not Satisfiable",
+                               QByteArray(), false, "Content-Range: bytes */" + QByteArray::number(size) + "\r\n");
+                        return;
+                    }
+
+                    partial = true;
+                }
+
+                QByteArray header = QByteArray("HTTP/1.1 ") + (partial ? "206 Partial Content" : "200 OK") + "\r\n"
+                        "Content-Type: application/octet-stream\r\n"
+                        "Accept-Ranges: bytes\r\n"
+                        "Connection: close\r\n"
+                        "Content-Length: " + QByteArray::number(end - begin + 1) + "\r\n";
+
+                if (partial) {
+                    header += "Content-Range: bytes " + QByteArray::number(begin) + "-" +
+                            QByteArray::number(end) + "/" + QByteArray::number(size) + "\r\n";
+                }
+
+                socket.write(header + "\r\n");
+
+                if (head)
+                    return;
+
+                // stream block by block, never holding more than the send buffer
+
+                for (qint64 pos = begin; pos <= end && !server->isStopping(); ) {
+                    NAO_TRACE("serve");
+
+                    qint64 block = pos / NArchiveServer::BlockSize;
+                    QByteArray data = server->block(index, block);
+                    qint64 from = pos - block * NArchiveServer::BlockSize;
+                    qint64 length = qMin(data.size() - from, end - pos + 1);
+
+                    // the client gets a short body if the entry can't be decoded
+
+                    if (length <= 0)
+                        return;
+
+                    socket.write(data.constData() + from, length);
+                    pos += length;
+
+                    while (socket.bytesToWrite() > SendBuffer) {
+                        if (!waitForBytesWritten(socket))
+                            return;
+                    }
+                }
+            }
+
+            void status(QTcpSocket& socket, const QByteArray& status, const QByteArray& body = QByteArray(),
+                        bool head = false, const QByteArray& extra = QByteArray()) {
+                QByteArray text = body.isEmpty() ? status + "\n" : body;
+
+                socket.write("HTTP/1.1 " + status + "\r\n"
+                             "Content-Type: text/plain; charset=utf-8\r\n"
+                             "Connection: close\r\n"
+                             "Content-Length: " + QByteArray::number(text.size()) + "\r\n" +
+                             extra + "\r\n");
+
+                if (!head)
+                    socket.write(text);
+            }
+
+            NArchiveServer* server;
+            qintptr descriptor;
+    };
+}
+
+NArchiveServer::NArchiveServer(NEntryReader* reader, QObject* parent)
+    : QTcpServer(parent),
+    reader(reader),
+    blocks(BlockCacheBytes),
+    decodedEntries(EntryCacheBytes) {
+
+    for (qint64 i = 0; i < reader->count(); ++i)
+        paths.insert(reader->path(i), i);
+
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+NArchiveServer::~NArchiveServer() {
+
+    // connections still use the reader, wait for them before it goes away. they notice
+    // stopping within StopPollMs and drop their client, however slow it is
+
+    stopping = true;
+    close();
+    pool.waitForDone();
+}
+
+bool NArchiveServer::start(quint16 port) {
+    return listen(QHostAddress::LocalHost, port);
+}
+
+QUrl NArchiveServer::url() const {
+    return QUrl(QString("http://127.0.0.1:%0/").arg(serverPort()));
+}
+
+QByteArray NArchiveServer::listing() const {
+    QByteArray result;
+
+    for (qint64 i = 0; i < reader->count(); ++i)
+        result += reader->path(i).toUtf8() + "\t" + QByteArray::number(reader->entrySize(i)) + "\n";
+
+    return result;
+}
+
+QByteArray NArchiveServer::block(qint64 index, qint64 block) {
+    const bool whole = !reader->hasRandomAccess(index) && reader->entrySize(index) <= NEntryReader::BufferLimit;
+
+    {
+        QMutexLocker lock(&blockMutex);
+
+        if (whole) {
+            if (QByteArray* cached = decodedEntries.object(index))
+                return cached->mid(static_cast<int>(block * BlockSize), static_cast<int>(BlockSize));
+        } else if (QByteArray* cached = blocks.object(qMakePair(index, block))) {
+            return *cached;
+        }
+    }
+
+    // a compressed entry is decoded from its end to the requested block, so reading it
+    // a window at a time costs more the further forward a client is. one decode of the
+    // whole entry serves every block of it
+
+    if (whole) {
+        QByteArray* data = new QByteArray(reader->read(index));
+        QByteArray result = data->mid(static_cast<int>(block * BlockSize), static_cast<int>(BlockSize));
+
+        // a failed decode is tried again next time rather than cached
+
+        if (data->size() != reader->entrySize(index)) {
+            delete data;
+            return result;
+        }
+
+        QMutexLocker lock(&blockMutex);
+        decodedEntries.insert(index, data, data->size());
+
+        return result;
+    }
+
+    // stored entries can be read anywhere. past BufferLimit, compressed ones are decoded up to
+    // the requested block anyway, so everything from there to the end (within limits) goes
+    // into the cache at once
+
+    qint64 length = reader->hasRandomAccess(index) ? BlockSize : DecodedEntryBytes;
+    QByteArray data = reader->read(index, block * BlockSize, length);
+
+    QMutexLocker lock(&blockMutex);
+
+    // backwards, so the requested block is the most recently used and the ones
+    // right after it are the last to be evicted
+
+    for (qint64 i = (data.size() + BlockSize - 1) / BlockSize - 1; i >= 0; --i) {
+        QByteArray* part = new QByteArray(data.mid(static_cast<int>(i * BlockSize), static_cast<int>(BlockSize)));
+
+        blocks.insert(qMakePair(index, block + i), part, part->size());
+    }
+
+    return data.left(static_cast<int>(BlockSize));
+}
+
+void NArchiveServer::incomingConnection(qintptr socket) {
+    pool.start(new NServerConnection(this, socket));
+}
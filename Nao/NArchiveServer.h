@@ -0,0 +1,65 @@
+#ifndef NARCHIVESERVER_H
+#define NARCHIVESERVER_H
+
+#include <QTcpServer>
+#include <QThreadPool>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QUrl>
+
+#include <atomic>
+
+#include "NEntryReader.h"
+
+// read-only HTTP server on the loopback interface that serves the entries of the
+// loaded archive in place. GET / lists every entry, GET /<path> returns one, and
+// Range requests are honoured so consumers can read just the parts they need.
+
+class NArchiveServer : public QTcpServer {
+        Q_OBJECT
+
+    public:
+        explicit NArchiveServer(NEntryReader* reader, QObject* parent = nullptr);
+        ~NArchiveServer();
+
+        // port 0 picks any free port
+
+        bool start(quint16 port = 0);
+
+        QUrl url() const;
+
+        // for the connection handlers
+
+        qint64 indexOf(const QString& path) const { return paths.value(path, -1); }
+        qint64 entrySize(qint64 index) const { return reader->entrySize(index); }
+        QByteArray listing() const;
+        bool isStopping() const { return stopping.load(); }
+
+        // a block of an entry, decoded on demand and cached
+
+        QByteArray block(qint64 index, qint64 block);
+
+        static const qint64 BlockSize = 256 << 10;
+
+    protected:
+        void incomingConnection(qintptr socket) override;
+
+    private:
+        NEntryReader* reader;
+        QHash<QString, qint64> paths;
+
+        // (entry, block) -> data, and whole decoded entries for compressed ones that
+        // fit in memory. both bounded in bytes
+
+        QCache<QPair<qint64, qint64>, QByteArray> blocks;
+        QCache<qint64, QByteArray> decodedEntries;
+        QMutex blockMutex;
+
+        // connections are handled on their own pool, so a slow client can't stall extraction
+
+        QThreadPool pool;
+        std::atomic<bool> stopping { false };
+};
+
+#endif // NARCHIVESERVER_H
@@ -0,0 +1,325 @@
+#include "NArchiveWriter.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <QFileInfo>
+#include <QQueue>
+
+#include <algorithm>
+#include <limits>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+// how much we copy between progress updates
+
+static const qint64 CopyChunk = 4 << 20;
+
+NArchiveWriter::NArchiveWriter(const QString& source)
+    : QObject(),
+    sourcePath(source) {
+
+}
+
+void NArchiveWriter::replaceFile(const QString& entry, const QString& file) {
+    replacements.insert(entry, file);
+}
+
+bool NArchiveWriter::write(const QString& targetPath) {
+    error.clear();
+
+    if (QFileInfo(targetPath) == QFileInfo(sourcePath))
+        return fail("An archive can't be written over itself");
+
+    source.setFileName(sourcePath);
+    target.setFileName(targetPath);
+
+    if (!source.open(QIODevice::ReadOnly))
+        return fail("Could not open " + sourcePath + " for reading");
+
+    // everything we copy as-is comes straight out of the mapping
+
+    sourceData = source.map(0, source.size());
+
+    if (!sourceData) {
+        source.close();
+        return fail("Could not map " + sourcePath);
+    }
+
+    if (!target.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        source.unmap(const_cast<uchar*>(sourceData));
+        source.close();
+        return fail("Could not open " + targetPath + " for writing");
+    }
+
+    bool success = writeArchive();
+
+    source.unmap(const_cast<uchar*>(sourceData));
+    source.close();
+    sourceData = nullptr;
+
+    if (!target.flush())
+        success = fail("Could not write " + targetPath);
+
+    target.close();
+
+    // don't leave half an archive behind
+
+    if (!success)
+        target.remove();
+
+    return success;
+}
+
+bool NArchiveWriter::writeEntries(QVector<Entry>& entries, qint64 alignment, qint64& tailStart, qint64& tailShift) {
+    QVector<Entry*> placed;
+    qint64 headerEnd = source.size();
+
+    progressMax = source.size();
+
+    for (Entry& e : entries) {
+        e.newOffset = e.offset;
+        e.newSize = e.size;
+
+        if (e.replaced()) {
+            progressMax += e.data.isEmpty() ? QFileInfo(e.replacement).size() : e.data.size();
+
+            if (!QFileInfo(e.replacement).isFile() && e.data.isEmpty())
+                return fail("Could not find " + e.replacement);
+        }
+
+        // empty entries keep their (meaningless) offset unless they get data
+
+        if (e.size > 0 || e.replaced())
+            placed.append(&e);
+
+        if (e.size > 0)
+            headerEnd = qMin(headerEnd, e.offset);
+    }
+
+    // entries that had no data before go after the rest
+
+    std::stable_sort(placed.begin(), placed.end(), [](const Entry* a, const Entry* b) {
+        return ((a->size > 0) ? a->offset : std::numeric_limits<qint64>::max()) <
+                ((b->size > 0) ? b->offset : std::numeric_limits<qint64>::max());
+    });
+
+    if (!copyRange(0, headerEnd))
+        return false;
+
+    // prepared data is made on worker threads while we write, in the order we need it.
+    // only so many entries are in flight, the rest of the archive never sits in memory
+
+    const int prepareAhead = 2 * QThreadPool::globalInstance()->maxThreadCount();
+
+    QVector<const Entry*> toPrepare;
+    QQueue<QFuture<QByteArray>> preparing;
+    int prepared = 0;
+
+    for (const Entry* e : placed) {
+        if (e->prepare)
+            toPrepare.append(e);
+    }
+
+    auto prepareMore = [&]() {
+        while (prepared < toPrepare.size() && preparing.size() < prepareAhead) {
+            const Entry* e = toPrepare.at(prepared++);
+
+            preparing.enqueue(QtConcurrent::run([this, e]() {
+                return prepareEntry(*e);
+            }));
+        }
+    };
+
+    prepareMore();
+
+    qint64 readPos = headerEnd;
+    qint64 shift = 0;
+    bool success = true;
+
+    for (Entry* e : placed) {
+        if (e->prepare) {
+            e->data = preparing.dequeue().result();
+            prepareMore();
+        }
+
+        // keep the original padding while nothing has moved, otherwise just align
+
+        if (e->size > 0 && shift == 0 && e->offset >= readPos)
+            success = copyRange(readPos, e->offset - readPos);
+        else
+            success = padTo(alignUp(target.pos(), alignment));
+
+        if (success) {
+            e->newOffset = target.pos();
+
+            if (!e->data.isEmpty())
+                success = writeData(e->data);
+            else if (e->replaced())
+                success = copyFile(e->replacement);
+            else
+                success = copyRange(e->offset, e->size);
+        }
+
+        if (e->prepare)
+            e->data = QByteArray();
+
+        if (!success)
+            break;
+
+        e->newSize = target.pos() - e->newOffset;
+
+        if (e->size > 0)
+            readPos = qMax(readPos, e->offset + e->size);
+
+        shift = target.pos() - readPos;
+    }
+
+    // the workers still read the entries, none may be left running once we return
+
+    while (!preparing.isEmpty())
+        preparing.dequeue().waitForFinished();
+
+    if (!success)
+        return false;
+
+    if (shift == 0) {
+        tailStart = readPos;
+        tailShift = 0;
+
+        return copyRange(readPos, source.size() - readPos);
+    }
+
+    // whatever follows the entries starts on an aligned boundary, keep it that way
+
+    tailStart = qMin(alignUp(readPos, alignment), source.size());
+
+    if (!padTo(alignUp(target.pos(), alignment)))
+        return false;
+
+    tailShift = target.pos() - tailStart;
+
+    return copyRange(tailStart, source.size() - tailStart);
+}
+
+qint64 NArchiveWriter::detectAlignment(const QVector<Entry>& entries) {
+    qint64 alignment = 0x800;
+
+    for (const Entry& e : entries) {
+        while (e.size > 0 && alignment > 1 && (e.offset % alignment) != 0)
+            alignment >>= 1;
+    }
+
+    return alignment;
+}
+
+bool NArchiveWriter::copyRange(qint64 offset, qint64 length) {
+    if (offset < 0 || length < 0 || offset + length > source.size())
+        return fail("Entry data lies outside of the archive");
+
+#ifdef Q_OS_LINUX
+
+    // let the kernel (or the filesystem, for reflinks) do the copy
+
+    if (length > 0 && target.flush()) {
+        loff_t in = offset;
+        loff_t out = target.pos();
+
+        while (length > 0) {
+            ssize_t copied = ::copy_file_range(source.handle(), &in, target.handle(), &out,
+                                               static_cast<size_t>(qMin(length, CopyChunk)), 0);
+
+            if (copied <= 0)
+                break;
+
+            length -= copied;
+
+            if (!target.seek(out))
+                return fail("Could not seek in " + target.fileName());
+
+            progress();
+        }
+
+        // anything left over (cross-device, unsupported filesystem) goes the slow way
+
+        offset = in;
+    }
+#endif
+
+    while (length > 0) {
+        qint64 chunk = qMin(length, CopyChunk);
+
+        if (target.write(reinterpret_cast<const char*>(sourceData + offset), chunk) != chunk)
+            return fail("Could not write " + target.fileName());
+
+        offset += chunk;
+        length -= chunk;
+
+        progress();
+    }
+
+    return true;
+}
+
+bool NArchiveWriter::copyFile(const QString& file) {
+    QFile input(file);
+
+    if (!input.open(QIODevice::ReadOnly))
+        return fail("Could not open " + file + " for reading");
+
+    while (!input.atEnd()) {
+        QByteArray chunk = input.read(CopyChunk);
+
+        if (chunk.isEmpty() && input.error() != QFileDevice::NoError)
+            return fail("Could not read " + file);
+
+        if (!writeData(chunk))
+            return false;
+    }
+
+    return true;
+}
+
+bool NArchiveWriter::writeData(const QByteArray& data) {
+    if (target.write(data) != data.size())
+        return fail("Could not write " + target.fileName());
+
+    progress();
+
+    return true;
+}
+
+bool NArchiveWriter::writeZeros(qint64 length) {
+    return (length <= 0) || writeData(QByteArray(static_cast<int>(length), '\0'));
+}
+
+bool NArchiveWriter::padTo(qint64 position) {
+    return writeZeros(position - target.pos());
+}
+
+bool NArchiveWriter::patch(qint64 position, const QByteArray& data) {
+    qint64 current = target.pos();
+
+    if (!target.seek(position) || target.write(data) != data.size() || !target.seek(current))
+        return fail("Could not update the tables in " + target.fileName());
+
+    return true;
+}
+
+bool NArchiveWriter::fail(const QString& message) {
+
+    // the first error is usually the interesting one
+
+    if (error.isEmpty())
+        error = message;
+
+    return false;
+}
+
+qint64 NArchiveWriter::alignUp(qint64 value, qint64 alignment) {
+    return (alignment <= 1) ? value : ((value + alignment - 1) / alignment) * alignment;
+}
+
+void NArchiveWriter::progress() {
+    emit writeProgress(target.pos(), qMax(progressMax, target.pos()));
+}
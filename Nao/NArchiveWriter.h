@@ -0,0 +1,111 @@
+#ifndef NARCHIVEWRITER_H
+#define NARCHIVEWRITER_H
+
+#include <QObject>
+#include <QFile>
+#include <QMap>
+#include <QVector>
+
+// rebuilds an archive with some of its entries replaced, copying everything
+// that didn't change byte-for-byte from the original
+
+class NArchiveWriter : public QObject {
+        Q_OBJECT
+
+    public:
+        explicit NArchiveWriter(const QString& source);
+        virtual ~NArchiveWriter() {}
+
+        // entries are identified by their path inside the archive, as shown in the table
+
+        void replaceFile(const QString& entry, const QString& file);
+
+        int replacementCount() const { return replacements.size(); }
+
+        bool write(const QString& target);
+
+        QString errorString() const { return error; }
+
+    signals:
+        void writeProgress(qint64 current, qint64 max);
+
+    protected:
+        struct Entry {
+            QString path;
+
+            // where it is in the source, size 0 means it has no data
+
+            qint64 offset = 0;
+            qint64 size = 0;
+
+            // filled in by writeEntries
+
+            qint64 newOffset = 0;
+            qint64 newSize = 0;
+
+            // prepared replacement data takes priority over the replacement file
+
+            QString replacement;
+            QByteArray data;
+
+            // replaced entries whose data comes from prepareEntry()
+
+            bool prepare = false;
+
+            bool replaced() const { return !replacement.isEmpty(); }
+        };
+
+        virtual bool writeArchive() = 0;
+
+        // the data for an entry marked prepare (a compressed replacement, say). called on
+        // worker threads, several entries at once. an empty result falls back to the file.
+
+        virtual QByteArray prepareEntry(const Entry& entry) const {
+            Q_UNUSED(entry);
+            return QByteArray();
+        }
+
+        // writes the whole target: everything before the first entry, the entries and whatever
+        // follows them. as long as nothing moved, the padding in between is copied as well,
+        // so an unmodified archive comes out identical. afterwards, data that followed the
+        // entries starts at tailStart + tailShift instead of tailStart. entries marked prepare
+        // are prepared a few at a time ahead of being written, and dropped once they are.
+
+        bool writeEntries(QVector<Entry>& entries, qint64 alignment, qint64& tailStart, qint64& tailShift);
+
+        // the largest power of two (up to 2048) all entry offsets are a multiple of
+
+        static qint64 detectAlignment(const QVector<Entry>& entries);
+
+        // source -> target, via copy_file_range where possible and the mapped source otherwise
+
+        bool copyRange(qint64 offset, qint64 length);
+        bool copyFile(const QString& file);
+        bool writeData(const QByteArray& data);
+        bool writeZeros(qint64 length);
+        bool padTo(qint64 position);
+
+        // overwrite already written output, leaving the position untouched
+
+        bool patch(qint64 position, const QByteArray& data);
+
+        bool fail(const QString& message);
+
+        static qint64 alignUp(qint64 value, qint64 alignment);
+
+        QString sourcePath;
+        QMap<QString, QString> replacements;
+
+        QFile source;
+        QFile target;
+        const uchar* sourceData = nullptr;
+
+        qint64 progressMax = 0;
+
+    private:
+        void progress();
+
+        QString error;
+};
+
+#endif // NARCHIVEWRITER_H
@@ -0,0 +1,220 @@
+#include "NBlobStore.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <cerrno>
+
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+// 0444, FILE_ATTRIBUTE_READONLY on Windows
+
+static const QFileDevice::Permissions ReadOnly =
+        QFileDevice::ReadOwner | QFileDevice::ReadUser | QFileDevice::ReadGroup | QFileDevice::ReadOther;
+
+#ifdef Q_OS_WIN
+
+// FileDispositionInfoEx (Windows 10 1809), older SDK headers don't have it
+
+namespace {
+    struct DispositionInfoEx {
+        DWORD Flags;
+    };
+
+    const FILE_INFO_BY_HANDLE_CLASS DispositionInfoExClass = static_cast<FILE_INFO_BY_HANDLE_CLASS>(21);
+    const DWORD DispositionDelete = 0x1;
+    const DWORD DispositionPosixSemantics = 0x2;
+    const DWORD DispositionIgnoreReadOnly = 0x10;
+}
+
+#endif
+
+NBlobStore::NBlobStore(const QString& root)
+    : rootPath(QDir(root).absolutePath()),
+    valid(QDir().mkpath(rootPath)) {
+
+}
+
+QString NBlobStore::blobPath(const QByteArray& hash) const {
+    QString hex = QString::fromLatin1(hash.toHex());
+
+    // spread over 256 directories, some filesystems slow down with huge directories
+
+    return rootPath + "/" + hex.left(2) + "/" + hex;
+}
+
+bool NBlobStore::contains(const QByteArray& hash) const {
+    return QFileInfo::exists(blobPath(hash));
+}
+
+QString NBlobStore::stagingTemplate() const {
+    return rootPath + "/staging-XXXXXX";
+}
+
+bool NBlobStore::insert(const QByteArray& hash, const QByteArray& data, QString& error, int& code) {
+    if (contains(hash))
+        return true;
+
+    QTemporaryFile staged(stagingTemplate());
+
+    if (!staged.open() || staged.write(data) != data.size() || !staged.flush()) {
+        code = systemError();
+        error = "Could not write to the store: " + staged.errorString();
+        return false;
+    }
+
+    return insert(hash, staged, error, code);
+}
+
+bool NBlobStore::insert(const QByteArray& hash, QTemporaryFile& staged, QString& error, int& code) {
+    QString blob = blobPath(hash);
+
+    // the staged file is removed along with the QTemporaryFile if it turns out to be a duplicate
+
+    if (QFileInfo::exists(blob))
+        return true;
+
+    if (!QDir().mkpath(QFileInfo(blob).absolutePath())) {
+        code = systemError();
+        error = "Could not create a directory in the store";
+        return false;
+    }
+
+    staged.close();
+
+    // another thread may have stored the same content in the meantime, which is just as good
+
+    if (!staged.rename(blob)) {
+        code = systemError();
+
+        if (QFileInfo::exists(blob))
+            return true;
+
+        error = "Could not move a blob into the store: " + staged.errorString();
+        return false;
+    }
+
+    // not fatal where the filesystem has no such thing, the blob is just as usable
+
+    QFile::setPermissions(blob, ReadOnly);
+
+    return true;
+}
+
+NBlobStore::Link NBlobStore::link(const QString& blob, const QString& target, QString& error, int& code) {
+
+    // links don't overwrite, and a stale file from an earlier run is no use anyway
+
+    if (QFileInfo::exists(target)) {
+        if (!removeTarget(target)) {
+            code = systemError();
+            error = "Could not replace " + target;
+            return Failed;
+        }
+    }
+
+#ifdef Q_OS_LINUX
+    {
+        QFile source(blob);
+        QFile clone(target);
+
+        if (source.open(QIODevice::ReadOnly) && clone.open(QIODevice::WriteOnly)) {
+            if (::ioctl(clone.handle(), FICLONE, source.handle()) == 0)
+                return Reflink;
+
+            clone.close();
+            clone.remove();
+        }
+    }
+
+    if (::link(QFile::encodeName(blob).constData(), QFile::encodeName(target).constData()) == 0)
+        return Hardlink;
+#endif
+
+#ifdef Q_OS_WIN
+    if (::CreateHardLinkW(reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(target).utf16()),
+                          reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(blob).utf16()),
+                          nullptr))
+        return Hardlink;
+#endif
+
+    // different filesystems, too many links to one inode, FAT, ...
+    // a copy is independent of the blob, so it doesn't keep its read-only flag
+
+    if (QFile::copy(blob, target)) {
+        QFile::setPermissions(target, QFile::permissions(target) | QFileDevice::WriteOwner | QFileDevice::WriteUser);
+
+        return Copy;
+    }
+
+    code = systemError();
+    error = "Could not link " + target + " to the store";
+
+    return Failed;
+}
+
+int NBlobStore::systemError() {
+#ifdef Q_OS_WIN
+    return static_cast<int>(GetLastError());
+#else
+    return errno;
+#endif
+}
+
+bool NBlobStore::removeTarget(const QString& target) {
+#ifdef Q_OS_WIN
+
+    // windows won't delete a read-only file, and a hardlink from an earlier run is one.
+    // attributes belong to the file, not the link, so clearing the flag on such a target
+    // would clear it on the blob and every other link to it as well
+
+    QString native = QDir::toNativeSeparators(target);
+    const wchar_t* path = reinterpret_cast<const wchar_t*>(native.utf16());
+
+    HANDLE file = ::CreateFileW(path, DELETE | FILE_READ_ATTRIBUTES,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    // unlinks the name right away and ignores the flag, without touching it
+
+    DispositionInfoEx disposition = { DispositionDelete | DispositionPosixSemantics | DispositionIgnoreReadOnly };
+
+    if (::SetFileInformationByHandle(file, DispositionInfoExClass, &disposition, sizeof(disposition))) {
+        ::CloseHandle(file);
+        return true;
+    }
+
+    // older systems and filesystems. the flag can only be cleared when nothing else shares it
+
+    BY_HANDLE_FILE_INFORMATION info;
+    bool shared = !::GetFileInformationByHandle(file, &info) || info.nNumberOfLinks > 1;
+
+    ::CloseHandle(file);
+
+    if (shared) {
+        ::SetLastError(ERROR_ACCESS_DENIED);
+        return false;
+    }
+
+    DWORD attributes = ::GetFileAttributesW(path);
+
+    if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_READONLY))
+        ::SetFileAttributesW(path, attributes & ~FILE_ATTRIBUTE_READONLY);
+
+    return ::DeleteFileW(path);
+#else
+    return QFile::remove(target);
+#endif
+}
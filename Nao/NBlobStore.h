@@ -0,0 +1,62 @@
+#ifndef NBLOBSTORE_H
+#define NBLOBSTORE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QTemporaryFile>
+
+// content-addressed store: every unique blob is kept once under its SHA-256
+// (<root>/ab/abcdef...), extracted files are links to it. safe to share between
+// threads and between runs, identical content simply ends up at the same path.
+// blobs are read-only, so editing a hardlinked file can't silently change every
+// other file with the same content.
+
+class NBlobStore {
+    public:
+
+        // how an extracted file ended up pointing at its blob
+
+        enum Link {
+            Failed,
+            Reflink,    // copy-on-write clone, behaves like an independent copy
+            Hardlink,   // same inode, read-only like the blob
+            Copy        // the filesystem supports neither
+        };
+
+        explicit NBlobStore(const QString& root);
+
+        bool isValid() const { return valid; }
+        QString root() const { return rootPath; }
+
+        QString blobPath(const QByteArray& hash) const;
+        bool contains(const QByteArray& hash) const;
+
+        // where to stream entries of unknown content before they are hashed
+
+        QString stagingTemplate() const;
+
+        // add a blob and make it read-only, a no-op (but still a success) if it is already stored.
+        // on failure code is errno (GetLastError() on Windows) of the call that failed
+
+        bool insert(const QByteArray& hash, const QByteArray& data, QString& error, int& code);
+        bool insert(const QByteArray& hash, QTemporaryFile& staged, QString& error, int& code);
+
+        // point target at a stored blob, replacing whatever was there
+
+        static Link link(const QString& blob, const QString& target, QString& error, int& code);
+
+    private:
+
+        // without changing the attributes of whatever else shares the file
+
+        static bool removeTarget(const QString& target);
+
+        // taken right after the failing call, anything run later may overwrite it
+
+        static int systemError();
+
+        QString rootPath;
+        bool valid;
+};
+
+#endif // NBLOBSTORE_H
@@ -0,0 +1,192 @@
+#include "NCPKWriter.h"
+#include "NCRILAYLA.h"
+#include "NUTFSchema.h"
+#include "NTrace.h"
+
+#include <QFileInfo>
+#include <QtEndian>
+
+static const qint64 ChunkHeaderSize = 0x10;
+
+bool NCPKWriter::readChunk(qint64 offset, const char* magic, QByteArray& table) {
+    if (offset < 0 || offset + ChunkHeaderSize > source.size() ||
+            qstrncmp(reinterpret_cast<const char*>(sourceData + offset), magic, 4) != 0)
+        return fail(QString("Could not find the %0 table in %1").arg(QString(magic).trimmed(), sourcePath));
+
+    quint64 size = qFromLittleEndian<quint64>(sourceData + offset + 8);
+
+    if (size > static_cast<quint64>(source.size() - offset - ChunkHeaderSize))
+        return fail(QString("The %0 table in %1 is truncated").arg(QString(magic).trimmed(), sourcePath));
+
+    table = QByteArray(reinterpret_cast<const char*>(sourceData + offset + ChunkHeaderSize), static_cast<int>(size));
+
+    return true;
+}
+
+bool NCPKWriter::patchTable(qint64 offset, const NUTFTable& original, const QByteArray& table) {
+    return patch(offset + ChunkHeaderSize, original.wasEncrypted() ? NUTFTable::decrypt(table) : table);
+}
+
+bool NCPKWriter::writeArchive() {
+    QByteArray headerBytes;
+
+    if (!readChunk(0, "CPK ", headerBytes))
+        return false;
+
+    NUTFTable header(headerBytes);
+
+    if (!header.isValid() || header.rowCount() != 1)
+        return fail(sourcePath + " has a corrupt header");
+
+    const qint64 tocOffset = header.value(0, "TocOffset").toLongLong();
+    const qint64 contentOffset = header.value(0, "ContentOffset").toLongLong();
+
+    // ID-only archives (ITOC without a TOC) have no names to match replacements against
+
+    if (tocOffset == 0)
+        return fail(sourcePath + " has no TOC, which is not supported");
+
+    QByteArray tocBytes;
+
+    if (!readChunk(tocOffset, "TOC ", tocBytes))
+        return false;
+
+    NUTFTable toc(tocBytes);
+    QVector<NTOCRow> rows;
+
+    {
+        NAO_TRACE("toc");
+
+        if (!NTOCSchema::read(toc, rows))
+            return fail(sourcePath + " has a corrupt TOC");
+    }
+
+    // the ITOC and GTOC keep sizes of their own, and CRCs cover the TOC or the files.
+    // we rebuild none of these, so they'd go stale as soon as anything is replaced
+
+    auto present = [&](const char* name) {
+        return header.value(0, name).toLongLong() != 0;
+    };
+
+    const int crc = toc.columnIndex("CRC");
+
+    if (!replacements.isEmpty() &&
+            (present("ItocOffset") || present("GtocOffset") || present("TocCrc") ||
+             present("EnableTocCrc") || present("EnableFileCrc") ||
+             (crc >= 0 && toc.column(crc).storage != NUTFTable::Zero)))
+        return fail(sourcePath + " has an ITOC, GTOC or CRCs, which can't be updated when replacing files");
+
+    // only needed to write the updated values back
+
+    const int fileOffset = toc.columnIndex("FileOffset");
+    const int fileSize = toc.columnIndex("FileSize");
+    const int extractSize = toc.columnIndex("ExtractSize");
+
+    // file offsets count from whichever comes first
+
+    const qint64 base = (contentOffset > 0) ? qMin(tocOffset, contentOffset) : tocOffset;
+
+    QVector<Entry> entries(rows.size());
+    QVector<qint64> extractSizes(entries.size());
+    QMap<QString, QString> remaining = replacements;
+
+    for (int row = 0; row < entries.size(); ++row) {
+        Entry& e = entries[row];
+        const NTOCRow& r = rows.at(row);
+
+        e.path = (r.dirName.isEmpty() ? "" : QString::fromUtf8(r.dirName) + "/") + QString::fromUtf8(r.fileName);
+        e.offset = base + r.fileOffset;
+        e.size = r.fileSize;
+        e.replacement = remaining.take(e.path);
+
+        extractSizes[row] = r.extractSize;
+
+        if (e.replaced()) {
+            extractSizes[row] = QFileInfo(e.replacement).size();
+
+            // only compress what was compressed before, some files (streamed audio) must stay raw
+
+            e.prepare = (r.extractSize != e.size);
+        }
+    }
+
+    if (!remaining.isEmpty())
+        return fail("The archive has no entry named " + remaining.firstKey());
+
+    const qint64 headerAlign = header.value(0, "Align").toLongLong();
+
+    qint64 tailStart;
+    qint64 tailShift;
+
+    if (!writeEntries(entries, (headerAlign > 0) ? headerAlign : detectAlignment(entries), tailStart, tailShift))
+        return false;
+
+    // update the TOC rows, an unmodified archive gets the same values back
+
+    QByteArray newToc = toc.bytes();
+    qint64 packedDelta = 0;
+    qint64 extractedDelta = 0;
+
+    for (int row = 0; row < entries.size(); ++row) {
+        const Entry& e = entries.at(row);
+
+        packedDelta += e.newSize - e.size;
+        extractedDelta += extractSizes.at(row) - rows.at(row).extractSize;
+
+        if (!NUTFTable::writeInteger(newToc, toc.cellOffset(row, fileOffset), toc.column(fileOffset).type, e.newOffset - base) ||
+                !NUTFTable::writeInteger(newToc, toc.cellOffset(row, fileSize), toc.column(fileSize).type, e.newSize) ||
+                !NUTFTable::writeInteger(newToc, toc.cellOffset(row, extractSize), toc.column(extractSize).type, extractSizes.at(row)))
+            return fail("The new size or offset of " + e.path + " doesn't fit the TOC");
+    }
+
+    auto moved = [&](qint64 position) {
+        return (position >= tailStart) ? position + tailShift : position;
+    };
+
+    // the header points at the other tables, and some of those (ETOC) come after the content
+
+    QByteArray newHeader = header.bytes();
+
+    auto adjust = [&](const char* name, qint64 delta) {
+        int column = header.columnIndex(name);
+
+        if (column < 0 || delta == 0)
+            return true;
+
+        return NUTFTable::writeInteger(newHeader, header.cellOffset(0, column), header.column(column).type,
+                                       header.value(0, column).toLongLong() + delta);
+    };
+
+    auto relocate = [&](const char* name) {
+        qint64 offset = header.value(0, name).toLongLong();
+
+        return (offset <= 0) || adjust(name, moved(offset) - offset);
+    };
+
+    if (!relocate("TocOffset") || !relocate("EtocOffset") || !relocate("HtocOffset") ||
+            !adjust("ContentSize", tailShift) ||
+            !adjust("EnabledPackedSize", packedDelta) ||
+            !adjust("EnabledDataSize", extractedDelta))
+        return fail("Could not update the CPK header");
+
+    return patchTable(moved(tocOffset), toc, newToc) && patchTable(0, header, newHeader);
+}
+
+QByteArray NCPKWriter::prepareEntry(const Entry& entry) const {
+
+    // compressing is by far the slowest part, writeEntries spreads it over all cores
+
+    NAO_TRACE("compress");
+
+    QFile file(entry.replacement);
+
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    QByteArray raw = file.readAll();
+    QByteArray compressed = NCRILAYLA::compress(raw);
+
+    // incompressible data is stored as-is, FileSize == ExtractSize marks it as such
+
+    return compressed.isEmpty() ? raw : compressed;
+}
@@ -0,0 +1,32 @@
+#ifndef NCPKWRITER_H
+#define NCPKWRITER_H
+
+#include "NArchiveWriter.h"
+#include "NUTFTable.h"
+
+// CRIWare .cpk archives: a header @UTF table and a TOC table listing every file.
+// replaced entries that were compressed get compressed again, in parallel.
+// archives with an ITOC, GTOC or CRCs can only be copied, we don't rebuild those.
+
+class NCPKWriter : public NArchiveWriter {
+        Q_OBJECT
+
+    public:
+        explicit NCPKWriter(const QString& source) : NArchiveWriter(source) {}
+
+    protected:
+        bool writeArchive() override;
+        QByteArray prepareEntry(const Entry& entry) const override;
+
+    private:
+
+        // chunks are a 4 byte magic, 4 unknown bytes, a 64-bit size and the table itself
+
+        bool readChunk(qint64 offset, const char* magic, QByteArray& table);
+
+        // write back a (possibly re-encrypted) table at the position it was read from
+
+        bool patchTable(qint64 offset, const NUTFTable& original, const QByteArray& table);
+};
+
+#endif // NCPKWRITER_H
@@ -0,0 +1,309 @@
+#include "NCRILAYLA.h"
+
+#include <QVector>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+    // back references are at least 3 bytes long and at most 2^13 + 2 bytes away
+
+    const int MinMatch = 3;
+    const int MaxDistance = (1 << 13) + 2;
+    const int MaxMatch = 0x1000;
+    const int MaxChain = 64;
+
+    // lengths are stored as a chain of fields, each field filled up means another follows
+
+    const int LengthBits[] = { 2, 3, 5, 8 };
+
+    // bits are packed MSB first, and the decoder consumes bytes from the end
+
+    class BitWriter {
+        public:
+            void write(quint32 value, int count) {
+                for (int i = count - 1; i >= 0; --i) {
+                    pool = static_cast<uchar>((pool << 1) | ((value >> i) & 1));
+
+                    if (++used == 8) {
+                        bytes.append(static_cast<char>(pool));
+                        pool = 0;
+                        used = 0;
+                    }
+                }
+            }
+
+            QByteArray finish() {
+                if (used > 0)
+                    bytes.append(static_cast<char>(pool << (8 - used)));
+
+                // the first byte written is the last one read
+
+                std::reverse(bytes.begin(), bytes.end());
+
+                return bytes;
+            }
+
+        private:
+            QByteArray bytes;
+            uchar pool = 0;
+            int used = 0;
+    };
+
+    class BitReader {
+        public:
+            BitReader(const uchar* begin, const uchar* end) : begin(begin), pos(end) {}
+
+            bool exhausted() const { return overrun; }
+
+            quint32 read(int count) {
+                quint32 value = 0;
+
+                while (count > 0) {
+                    if (left == 0) {
+                        if (pos == begin) {
+                            overrun = true;
+                            return 0;
+                        }
+
+                        pool = *--pos;
+                        left = 8;
+                    }
+
+                    int take = qMin(left, count);
+
+                    value = (value << take) | ((pool >> (left - take)) & ((1 << take) - 1));
+                    left -= take;
+                    count -= take;
+                }
+
+                return value;
+            }
+
+        private:
+            const uchar* begin;
+            const uchar* pos;
+            uchar pool = 0;
+            int left = 0;
+            bool overrun = false;
+    };
+
+    inline int hashAt(const uchar* p) {
+
+        // the three bytes ending at p, as we walk backwards
+
+        return ((p[0] << 8) ^ (p[-1] << 4) ^ p[-2]) & 0xFFFF;
+    }
+}
+
+bool NCRILAYLA::isCompressed(const QByteArray& data) {
+    return data.size() >= HeaderSize + PrefixSize && data.startsWith("CRILAYLA");
+}
+
+QByteArray NCRILAYLA::compress(const QByteArray& data) {
+    if (data.size() <= PrefixSize + MinMatch)
+        return QByteArray();
+
+    const uchar* src = reinterpret_cast<const uchar*>(data.constData());
+    const int end = data.size();
+
+    // hash chains over every position we've passed, newest (lowest) first
+
+    QVector<int> head(0x10000, -1);
+    QVector<int> prev(end, -1);
+
+    BitWriter writer;
+
+    int p = end - 1;
+
+    auto insert = [&](int pos) {
+        if (pos - 2 >= PrefixSize) {
+            int h = hashAt(src + pos);
+            prev[pos] = head[h];
+            head[h] = pos;
+        }
+    };
+
+    while (p >= PrefixSize) {
+        int bestLength = 0;
+        int bestDistance = 0;
+
+        if (p - 2 >= PrefixSize) {
+            int limit = qMin(MaxMatch, p - PrefixSize + 1);
+            int tries = MaxChain;
+
+            for (int q = head[hashAt(src + p)]; q >= 0 && tries > 0; q = prev[q], --tries) {
+                int distance = q - p;
+
+                if (distance > MaxDistance)
+                    break;
+
+                if (distance < MinMatch)
+                    continue;
+
+                int length = 0;
+
+                while (length < limit && src[q - length] == src[p - length])
+                    ++length;
+
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = distance;
+
+                    if (length == limit)
+                        break;
+                }
+            }
+        }
+
+        if (bestLength >= MinMatch) {
+            writer.write(1, 1);
+            writer.write(bestDistance - MinMatch, 13);
+
+            int remaining = bestLength - MinMatch;
+            bool done = false;
+
+            for (int bits : LengthBits) {
+                int max = (1 << bits) - 1;
+
+                if (remaining < max) {
+                    writer.write(remaining, bits);
+                    done = true;
+                    break;
+                }
+
+                writer.write(max, bits);
+                remaining -= max;
+            }
+
+            if (!done) {
+                while (remaining >= 0xFF) {
+                    writer.write(0xFF, 8);
+                    remaining -= 0xFF;
+                }
+
+                writer.write(remaining, 8);
+            }
+
+            for (int i = 0; i < bestLength; ++i)
+                insert(p - i);
+
+            p -= bestLength;
+        } else {
+            writer.write(0, 1);
+            writer.write(src[p], 8);
+
+            insert(p);
+
+            --p;
+        }
+    }
+
+    QByteArray stream = writer.finish();
+
+    if (HeaderSize + stream.size() + PrefixSize >= data.size())
+        return QByteArray();
+
+    QByteArray result(HeaderSize, '\0');
+    uchar* header = reinterpret_cast<uchar*>(result.data());
+
+    std::memcpy(header, "CRILAYLA", 8);
+    qToLittleEndian<quint32>(data.size() - PrefixSize, header + 8);
+    qToLittleEndian<quint32>(stream.size(), header + 12);
+
+    result.append(stream);
+    result.append(data.constData(), PrefixSize);
+
+    return result;
+}
+
+qint64 NCRILAYLA::decompressedSize(const QByteArray& data) {
+    if (!isCompressed(data))
+        return -1;
+
+    return qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(data.constData()) + 8) + PrefixSize;
+}
+
+qint64 NCRILAYLA::prefixPosition(const QByteArray& header) {
+    if (header.size() < HeaderSize || !header.startsWith("CRILAYLA"))
+        return -1;
+
+    return HeaderSize + qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(header.constData()) + 12);
+}
+
+QByteArray NCRILAYLA::decompress(const QByteArray& data) {
+    return decompress(data, 0, -1);
+}
+
+QByteArray NCRILAYLA::decompress(const QByteArray& data, qint64 offset, qint64 length) {
+    if (!isCompressed(data))
+        return QByteArray();
+
+    const uchar* src = reinterpret_cast<const uchar*>(data.constData());
+    const qint64 size = qFromLittleEndian<quint32>(src + 8);
+    const qint64 streamSize = qFromLittleEndian<quint32>(src + 12);
+
+    if (HeaderSize + streamSize + PrefixSize > data.size() || offset < 0 || offset > size + PrefixSize)
+        return QByteArray();
+
+    if (length < 0 || length > size + PrefixSize - offset)
+        length = size + PrefixSize - offset;
+
+    // the prefix is stored as-is, a range inside it needs no decoding at all
+
+    if (offset + length <= PrefixSize)
+        return data.mid(static_cast<int>(HeaderSize + streamSize + offset), static_cast<int>(length));
+
+    QByteArray result(static_cast<int>(size + PrefixSize), '\0');
+    uchar* out = reinterpret_cast<uchar*>(result.data());
+
+    std::memcpy(out, src + HeaderSize + streamSize, PrefixSize);
+
+    BitReader reader(src + HeaderSize, src + HeaderSize + streamSize);
+
+    // output is produced from the last byte towards the prefix, so we can stop
+    // as soon as everything from the start of the range onwards is there
+
+    const qint64 stop = qMax<qint64>(offset, PrefixSize);
+    qint64 p = PrefixSize + size - 1;
+
+    while (p >= stop) {
+        if (reader.read(1)) {
+            qint64 from = p + reader.read(13) + MinMatch;
+            qint64 matchLength = MinMatch;
+            quint32 field = 0;
+            bool more = true;
+
+            for (int bits : LengthBits) {
+                field = reader.read(bits);
+                matchLength += field;
+
+                if (field != static_cast<quint32>((1 << bits) - 1)) {
+                    more = false;
+                    break;
+                }
+            }
+
+            while (more) {
+                field = reader.read(8);
+                matchLength += field;
+                more = (field == 0xFF) && !reader.exhausted();
+            }
+
+            if (from >= PrefixSize + size || reader.exhausted())
+                return QByteArray();
+
+            for (; matchLength > 0 && p >= PrefixSize; --matchLength)
+                out[p--] = out[from--];
+        } else {
+            out[p--] = static_cast<uchar>(reader.read(8));
+        }
+
+        if (reader.exhausted())
+            return QByteArray();
+    }
+
+    return (length == result.size()) ? result : result.mid(static_cast<int>(offset), static_cast<int>(length));
+}
@@ -0,0 +1,34 @@
+#ifndef NCRILAYLA_H
+#define NCRILAYLA_H
+
+#include <QByteArray>
+
+// CRILAYLA is the LZ-style compression used for CPK entries. The first 0x100 bytes
+// of a file are stored raw at the end, everything after that is compressed back to front.
+
+namespace NCRILAYLA {
+    const int HeaderSize = 0x10;
+    const int PrefixSize = 0x100;
+
+    bool isCompressed(const QByteArray& data);
+
+    // returns an empty array if compressing would not make the data smaller
+
+    QByteArray compress(const QByteArray& data);
+    QByteArray decompress(const QByteArray& data);
+
+    // only length bytes (everything if negative) from offset in the decompressed data.
+    // decoding stops once the range is complete, a range within the prefix costs nothing.
+
+    QByteArray decompress(const QByteArray& data, qint64 offset, qint64 length);
+
+    // the size data decompresses to, -1 if it isn't compressed
+
+    qint64 decompressedSize(const QByteArray& data);
+
+    // where the raw prefix is in compressed data, given just its first HeaderSize bytes
+
+    qint64 prefixPosition(const QByteArray& header);
+}
+
+#endif // NCRILAYLA_H
@@ -0,0 +1,65 @@
+#include "NConcurrencyTuner.h"
+
+#include <QtGlobal>
+
+NConcurrencyTuner::NConcurrencyTuner(int initial, int minimum, int maximum, int remembered)
+    : current(qBound(minimum, (remembered > 0) ? remembered : initial, maximum)),
+    minimum(minimum),
+    maximum(maximum),
+    bestValue(current),
+    settled(remembered > 0) {
+
+}
+
+void NConcurrencyTuner::report(double rate) {
+    if (settled)
+        return;
+
+    ++measurements;
+
+    if (measurements == 1 || rate > bestRate * Threshold) {
+
+        // faster, keep going the same way
+
+        bestValue = current;
+        bestRate = rate;
+
+        // already at the top to begin with, see if fewer does better
+
+        if (step() || (measurements == 1 && turn()))
+            return;
+
+        settled = true;
+        return;
+    }
+
+    // slower (or no better, which isn't worth the threads), so go back. if that was
+    // the very first step fewer threads might still help, otherwise we came from there.
+
+    current = bestValue;
+
+    if (measurements == 2 && turn())
+        return;
+
+    settled = true;
+}
+
+bool NConcurrencyTuner::turn() {
+    if (direction < 0)
+        return false;
+
+    direction = -1;
+
+    return step();
+}
+
+bool NConcurrencyTuner::step() {
+    int next = qBound(minimum, (direction > 0) ? current * 2 : current / 2, maximum);
+
+    if (next == current)
+        return false;
+
+    current = next;
+
+    return true;
+}
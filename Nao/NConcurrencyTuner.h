@@ -0,0 +1,47 @@
+#ifndef NCONCURRENCYTUNER_H
+#define NCONCURRENCYTUNER_H
+
+// finds a good thread count for one stage by hill climbing on its throughput:
+// keep doubling (or halving) while that makes things faster, then stay at the best.
+// a value remembered from an earlier run is used as-is.
+
+class NConcurrencyTuner {
+    public:
+        NConcurrencyTuner(int initial, int minimum, int maximum, int remembered = 0);
+
+        // the thread count to use for the next round
+
+        int value() const { return current; }
+        int best() const { return bestValue; }
+
+        bool isSettled() const { return settled; }
+
+        // whether there is anything worth remembering
+
+        bool hasMeasured() const { return measurements > 1; }
+
+        // throughput of a round run with value() threads, in bytes per second
+
+        void report(double rate);
+
+        // a new value has to beat the best by this much to count as faster
+
+        static constexpr double Threshold = 1.05;
+
+    private:
+        bool step();
+        bool turn();
+
+        int current;
+        int minimum;
+        int maximum;
+
+        int bestValue;
+        double bestRate = 0;
+
+        int direction = 1;
+        bool settled;
+        int measurements = 0;
+};
+
+#endif // NCONCURRENCYTUNER_H
@@ -0,0 +1,72 @@
+#include "NDATWriter.h"
+
+#include <QtEndian>
+
+bool NDATWriter::writeArchive() {
+    const qint64 size = source.size();
+
+    if (size < 0x20 || qstrncmp(reinterpret_cast<const char*>(sourceData), "DAT", 4) != 0)
+        return fail(sourcePath + " is not a DAT archive");
+
+    const quint32 count = qFromLittleEndian<quint32>(sourceData + 4);
+    const quint32 offsetsTable = qFromLittleEndian<quint32>(sourceData + 8);
+    const quint32 namesTable = qFromLittleEndian<quint32>(sourceData + 16);
+    const quint32 sizesTable = qFromLittleEndian<quint32>(sourceData + 20);
+
+    if (offsetsTable + 4ULL * count > static_cast<quint64>(size) ||
+            sizesTable + 4ULL * count > static_cast<quint64>(size) ||
+            namesTable + 4ULL > static_cast<quint64>(size))
+        return fail(sourcePath + " has a corrupt header");
+
+    // names are fixed-length, null-padded strings
+
+    const quint32 nameLength = qFromLittleEndian<quint32>(sourceData + namesTable);
+
+    if (namesTable + 4ULL + static_cast<quint64>(nameLength) * count > static_cast<quint64>(size))
+        return fail(sourcePath + " has a corrupt name table");
+
+    QVector<Entry> entries(count);
+    QMap<QString, QString> remaining = replacements;
+
+    for (quint32 i = 0; i < count; ++i) {
+        Entry& e = entries[i];
+        const char* name = reinterpret_cast<const char*>(sourceData + namesTable + 4 + i * nameLength);
+
+        e.path = QString::fromLatin1(name, static_cast<int>(qstrnlen(name, nameLength)));
+        e.offset = qFromLittleEndian<quint32>(sourceData + offsetsTable + 4 * i);
+        e.size = qFromLittleEndian<quint32>(sourceData + sizesTable + 4 * i);
+        e.replacement = remaining.take(e.path);
+    }
+
+    if (!remaining.isEmpty())
+        return fail("The archive has no entry named " + remaining.firstKey());
+
+    qint64 tailStart;
+    qint64 tailShift;
+
+    if (!writeEntries(entries, detectAlignment(entries), tailStart, tailShift))
+        return false;
+
+    // rewrite the offset and size tables, an unmodified archive gets the same values back
+
+    QByteArray offsets(4 * count, '\0');
+    QByteArray sizes(4 * count, '\0');
+
+    for (quint32 i = 0; i < count; ++i) {
+        if (entries.at(i).newOffset > 0xFFFFFFFFLL || entries.at(i).newSize > 0xFFFFFFFFLL)
+            return fail("The archive would grow past 4 GiB");
+
+        qToLittleEndian<quint32>(static_cast<quint32>(entries.at(i).newOffset),
+                                 reinterpret_cast<uchar*>(offsets.data()) + 4 * i);
+        qToLittleEndian<quint32>(static_cast<quint32>(entries.at(i).newSize),
+                                 reinterpret_cast<uchar*>(sizes.data()) + 4 * i);
+    }
+
+    // tables that came after the entries have moved along with them
+
+    auto moved = [&](qint64 position) {
+        return (position >= tailStart) ? position + tailShift : position;
+    };
+
+    return patch(moved(offsetsTable), offsets) && patch(moved(sizesTable), sizes);
+}
@@ -0,0 +1,18 @@
+#ifndef NDATWRITER_H
+#define NDATWRITER_H
+
+#include "NArchiveWriter.h"
+
+// PlatinumGames .dat archives: a header pointing at tables of offsets, extensions, names and sizes
+
+class NDATWriter : public NArchiveWriter {
+        Q_OBJECT
+
+    public:
+        explicit NDATWriter(const QString& source) : NArchiveWriter(source) {}
+
+    protected:
+        bool writeArchive() override;
+};
+
+#endif // NDATWRITER_H
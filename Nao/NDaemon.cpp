@@ -0,0 +1,440 @@
+#include "NDaemon.h"
+#include "NExtractor.h"
+#include "NBlobStore.h"
+#include "NTrace.h"
+
+#include <QRunnable>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+
+#include <cstdio>
+
+// entry lists can get long, but not this long
+
+static const qint64 MaxRequestSize = 16 << 20;
+static const int SocketTimeout = 30000;
+
+namespace {
+    QByteArray toLine(const QJsonObject& object) {
+        return QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n';
+    }
+
+    // one request, run on the shared pool
+
+    class NDaemonJob : public QRunnable {
+        public:
+            NDaemonJob(NDaemon* daemon, quint64 client, const QJsonObject& request)
+                : daemon(daemon), client(client), request(request), id(request.value("id")) {
+
+            }
+
+            void run() override {
+                daemon->jobStarted();
+
+                QJsonObject result = execute();
+
+                result.insert("id", id);
+                result.insert("done", true);
+
+                emit daemon->reply(client, toLine(result));
+
+                daemon->jobFinished();
+            }
+
+        private:
+            QJsonObject execute() {
+                QString op = request.value("op").toString();
+
+                if (op != "list" && op != "extract")
+                    return failure("Unknown op \"" + op + "\"");
+
+                QString error;
+                QSharedPointer<NDaemon::Archive> archive = daemon->archive(request.value("archive").toString(), error);
+
+                if (!archive)
+                    return failure(error);
+
+                return (op == "list") ? list(*archive) : extract(*archive);
+            }
+
+            QJsonObject list(const NDaemon::Archive& archive) {
+                NAO_TRACE("list");
+
+                QJsonArray entries;
+
+                for (qint64 i = 0; i < archive.reader->count(); ++i) {
+                    NEntryReader::Info info = archive.reader->info(i);
+
+                    entries.append(QJsonObject {
+                        { "index", i },
+                        { "path", info.path },
+                        { "type", info.type },
+                        { "size", info.size },
+                        { "extractedSize", info.extractedSize }
+                    });
+                }
+
+                return QJsonObject { { "entries", entries } };
+            }
+
+            QJsonObject extract(const NDaemon::Archive& archive) {
+                QString output = request.value("output").toString();
+
+                if (output.isEmpty())
+                    return failure("No output directory given");
+
+                // entries can be given by path or by index, nothing means everything
+
+                QVector<qint64> indices;
+                QJsonArray requested = request.value("entries").toArray();
+
+                for (const QJsonValue& value : requested) {
+                    qint64 index = value.isString() ?
+                                archive.paths.value(value.toString(), -1) :
+                                static_cast<qint64>(value.toDouble(-1));
+
+                    if (index < 0 || index >= archive.reader->count())
+                        return failure("No such entry: " + (value.isString() ? value.toString() : QString::number(value.toDouble())));
+
+                    indices.append(index);
+                }
+
+                if (requested.isEmpty()) {
+                    for (qint64 i = 0; i < archive.reader->count(); ++i)
+                        indices.append(i);
+                }
+
+                QScopedPointer<NBlobStore> store;
+
+                if (request.contains("store")) {
+                    store.reset(new NBlobStore(request.value("store").toString()));
+
+                    if (!store->isValid())
+                        return failure("Could not create the store in " + store->root());
+                }
+
+                NExtractor extractor(archive.reader, output, indices);
+
+                if (store)
+                    extractor.setStore(store.data());
+
+                // just a slice of every entry, e.g. to sniff headers
+
+                if (request.contains("offset") || request.contains("length"))
+                    extractor.setRange(static_cast<qint64>(request.value("offset").toDouble(0)),
+                                       static_cast<qint64>(request.value("length").toDouble(-1)));
+
+                qint64 total = 0;
+
+                for (qint64 index : indices)
+                    total += extractor.entryBytes(index);
+
+                // run() emits from this thread, so this is a direct call
+
+                qint64 done = 0;
+                QElapsedTimer sinceReply;
+                sinceReply.start();
+
+                QObject::connect(&extractor, &NExtractor::progress, [&](qint64 bytes) {
+                    done += bytes;
+
+                    if (sinceReply.elapsed() >= NDaemon::ProgressInterval) {
+                        sinceReply.restart();
+
+                        emit daemon->reply(client, toLine({ { "id", id }, { "progress", done }, { "total", total } }));
+                    }
+                });
+
+                extractor.run();
+
+                QJsonArray failures;
+
+                for (const NExtractor::Failure& f : extractor.failures()) {
+                    failures.append(QJsonObject {
+                        { "index", f.index },
+                        { "path", f.path },
+                        { "reason", f.reason },
+                        { "attempts", f.attempts }
+                    });
+                }
+
+                return QJsonObject {
+                    { "written", extractor.bytesWritten() },
+                    { "deduplicated", extractor.bytesDeduplicated() },
+                    { "failures", failures }
+                };
+            }
+
+            static QJsonObject failure(const QString& error) {
+                return QJsonObject { { "error", error } };
+            }
+
+            NDaemon* daemon;
+            quint64 client;
+            QJsonObject request;
+            QJsonValue id;
+    };
+}
+
+NDaemon::Archive::~Archive() {
+    delete reader;
+    delete CRIWareReader;
+    delete PG_DATReader;
+}
+
+NDaemon::NDaemon(QObject* parent)
+    : QLocalServer(parent) {
+
+    // nobody but us gets to submit jobs
+
+    setSocketOptions(QLocalServer::UserAccessOption);
+
+    connect(this, &NDaemon::reply, this, &NDaemon::send, Qt::QueuedConnection);
+}
+
+NDaemon::~NDaemon() {
+    close();
+
+    // queued jobs still run, their replies just go nowhere
+
+    pool.waitForDone();
+}
+
+bool NDaemon::start(const QString& name) {
+    if (listen(name))
+        return true;
+
+    // a daemon that crashed leaves its socket behind, but don't take over a live one
+
+    QLocalSocket probe;
+    probe.connectToServer(name);
+
+    if (probe.waitForConnected(1000))
+        return false;
+
+    QLocalServer::removeServer(name);
+
+    return listen(name);
+}
+
+int NDaemon::submit(const QString& request, const QString& name) {
+    QLocalSocket socket;
+    socket.connectToServer(name);
+
+    if (!socket.waitForConnected(SocketTimeout)) {
+        fprintf(stderr, "Could not connect to %s: %s\n", qPrintable(name), qPrintable(socket.errorString()));
+        return 1;
+    }
+
+    socket.write(request.toUtf8().trimmed() + '\n');
+
+    forever {
+        while (!socket.canReadLine()) {
+
+            // jobs can take as long as they take
+
+            if (!socket.waitForReadyRead(-1)) {
+                fprintf(stderr, "Lost the connection to %s\n", qPrintable(name));
+                return 1;
+            }
+        }
+
+        QByteArray line = socket.readLine();
+
+        fwrite(line.constData(), 1, static_cast<size_t>(line.size()), stdout);
+        fflush(stdout);
+
+        QJsonObject object = QJsonDocument::fromJson(line).object();
+
+        if (object.value("done").toBool())
+            return (object.contains("error") || !object.value("failures").toArray().isEmpty()) ? 1 : 0;
+    }
+}
+
+QSharedPointer<NDaemon::Archive> NDaemon::archive(const QString& path, QString& error) {
+    QFileInfo info(path);
+
+    if (!info.isFile()) {
+        error = "Could not find " + path;
+        return QSharedPointer<Archive>();
+    }
+
+    QString canonical = info.canonicalFilePath();
+    QMutexLocker lock(&archiveMutex);
+
+    for (int i = 0; i < archives.size(); ++i) {
+        if (archives.at(i)->path != canonical)
+            continue;
+
+        QSharedPointer<Archive> cached = archives.takeAt(i);
+
+        // a rewritten archive has to be parsed again
+
+        if (cached->modified == info.lastModified()) {
+            archives.append(cached);
+            return cached;
+        }
+
+        break;
+    }
+
+    // someone else is already parsing it, share their result
+
+    if (QSharedPointer<Loading> pending = loading.value(canonical)) {
+        while (!pending->done)
+            archiveLoaded.wait(&archiveMutex);
+
+        error = pending->error;
+
+        return pending->archive;
+    }
+
+    QSharedPointer<Loading> pending(new Loading);
+    loading.insert(canonical, pending);
+
+    // parse without the lock, so jobs for other archives (and status) don't have to wait
+
+    lock.unlock();
+
+    QSharedPointer<Archive> loaded = load(canonical, info.lastModified(), error);
+
+    lock.relock();
+
+    pending->done = true;
+    pending->archive = loaded;
+    pending->error = error;
+
+    loading.remove(canonical);
+    archiveLoaded.wakeAll();
+
+    if (loaded) {
+        archives.append(loaded);
+
+        // jobs still using an evicted archive keep it alive until they finish
+
+        while (archives.size() > MaxArchives)
+            archives.removeFirst();
+    }
+
+    return loaded;
+}
+
+QSharedPointer<NDaemon::Archive> NDaemon::load(const QString& path, const QDateTime& modified, QString& error) {
+    QSharedPointer<Archive> loaded(new Archive);
+    loaded->path = path;
+    loaded->modified = modified;
+    loaded->type = LibNao::Utils::isFileSupported(path) ? LibNao::Utils::getFileType(path) : LibNao::None;
+
+    {
+        NAO_TRACE("parse");
+
+        switch (loaded->type) {
+            case LibNao::CRIWare:
+                loaded->CRIWareReader = new NaoCRIWareReader(path);
+                loaded->CRIWareReader->moveToThread(thread());
+                break;
+
+            case LibNao::PG_DAT:
+                loaded->PG_DATReader = new NaoDATReader(path);
+                loaded->PG_DATReader->moveToThread(thread());
+                break;
+
+            default:
+                error = path + " is not a supported archive";
+                return QSharedPointer<Archive>();
+        }
+    }
+
+    loaded->reader = new NEntryReader(loaded->type, path, loaded->CRIWareReader, loaded->PG_DATReader);
+
+    for (qint64 i = 0; i < loaded->reader->count(); ++i)
+        loaded->paths.insert(loaded->reader->path(i), i);
+
+    return loaded;
+}
+
+QJsonObject NDaemon::status() {
+    QJsonArray loaded;
+
+    {
+        QMutexLocker lock(&archiveMutex);
+
+        for (const QSharedPointer<Archive>& archive : archives)
+            loaded.append(archive->path);
+    }
+
+    return QJsonObject {
+        { "archives", loaded },
+        { "queued", queued.load() },
+        { "running", running.load() },
+        { "threads", pool.maxThreadCount() }
+    };
+}
+
+void NDaemon::incomingConnection(quintptr descriptor) {
+    QLocalSocket* socket = new QLocalSocket(this);
+
+    if (!socket->setSocketDescriptor(descriptor)) {
+        delete socket;
+        return;
+    }
+
+    quint64 client = nextClient++;
+    clients.insert(client, socket);
+
+    connect(socket, &QLocalSocket::readyRead, this, [=]() {
+        while (socket->canReadLine())
+            request(client, socket->readLine().trimmed());
+
+        if (socket->bytesAvailable() > MaxRequestSize)
+            socket->abort();
+    });
+
+    connect(socket, &QLocalSocket::disconnected, this, [=]() {
+        clients.remove(client);
+        socket->deleteLater();
+    });
+}
+
+void NDaemon::request(quint64 client, const QByteArray& line) {
+    if (line.isEmpty())
+        return;
+
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+
+    if (!document.isObject()) {
+        QString reason = (parseError.error != QJsonParseError::NoError) ? parseError.errorString() : "not an object";
+
+        send(client, toLine({ { "done", true }, { "error", "Malformed request: " + reason } }));
+        return;
+    }
+
+    QJsonObject request = document.object();
+
+    // status is answered right away instead of waiting behind the jobs it describes
+
+    if (request.value("op").toString() == "status") {
+        QJsonObject result = status();
+
+        result.insert("id", request.value("id"));
+        result.insert("done", true);
+
+        send(client, toLine(result));
+        return;
+    }
+
+    ++queued;
+
+    pool.start(new NDaemonJob(this, client, request), request.value("priority").toInt());
+}
+
+void NDaemon::send(quint64 client, const QByteArray& line) {
+    QLocalSocket* socket = clients.value(client);
+
+    if (socket)
+        socket->write(line);
+}
@@ -0,0 +1,126 @@
+#ifndef NDAEMON_H
+#define NDAEMON_H
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QThreadPool>
+#include <QSharedPointer>
+#include <QDateTime>
+#include <QJsonObject>
+#include <QHash>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+
+#include <libnao.h>
+#include <NaoCRIWareReader.h>
+#include <NaoDATReader.h>
+
+#include "NEntryReader.h"
+
+// long-running service that keeps parsed archives around and runs jobs for any
+// number of local clients on one shared, prioritised worker pool.
+//
+// clients send one JSON object per line and get JSON lines back, each carrying
+// the "id" of the request it belongs to, the last one with "done": true:
+//
+//   {"op": "status"}
+//   {"op": "list", "archive": path}
+//   {"op": "extract", "archive": path, "output": dir, "entries": [path or index, ...],
+//    "priority": n, "store": dir, "offset": n, "length": n}
+//
+// "entries" defaults to everything, higher priorities run first and "store" enables
+// deduplication into the given directory. "offset" and "length" extract just that range
+// of every entry. extract jobs report {"progress", "total"} along the way and
+// {"written", "deduplicated", "failures"} at the end, any op that couldn't run at all
+// ends with {"error"}.
+
+class NDaemon : public QLocalServer {
+        Q_OBJECT
+
+    public:
+        explicit NDaemon(QObject* parent = nullptr);
+        ~NDaemon();
+
+        static QString defaultName() { return "nao-daemon"; }
+
+        bool start(const QString& name = defaultName());
+
+        // blocking client for scripts: sends one request, prints every reply to stdout.
+        // returns 0 if the job completed without errors or failed entries.
+
+        static int submit(const QString& request, const QString& name = defaultName());
+
+        // a parsed archive, shared with every job that uses it
+
+        struct Archive {
+            ~Archive();
+
+            QString path;
+            QDateTime modified;
+            LibNao::FileType type = LibNao::None;
+
+            NaoCRIWareReader* CRIWareReader = nullptr;
+            NaoDATReader* PG_DATReader = nullptr;
+            NEntryReader* reader = nullptr;
+
+            QHash<QString, qint64> paths;
+        };
+
+        // for the jobs, may be called from any thread
+
+        QSharedPointer<Archive> archive(const QString& path, QString& error);
+        QJsonObject status();
+
+        void jobStarted() { --queued; ++running; }
+        void jobFinished() { --running; }
+
+        static const int MaxArchives = 16;
+        static const qint64 ProgressInterval = 250; // ms between progress replies
+
+    signals:
+
+        // jobs reply through this, so the sockets are only ever touched by our own thread
+
+        void reply(quint64 client, const QByteArray& line);
+
+    protected:
+        void incomingConnection(quintptr descriptor) override;
+
+    private:
+        void request(quint64 client, const QByteArray& line);
+        void send(quint64 client, const QByteArray& line);
+
+        // parse an archive, without holding any lock
+
+        QSharedPointer<Archive> load(const QString& path, const QDateTime& modified, QString& error);
+
+        QHash<quint64, QLocalSocket*> clients;
+        quint64 nextClient = 0;
+
+        // most recently used last
+
+        QList<QSharedPointer<Archive>> archives;
+        QMutex archiveMutex;
+
+        // archives being parsed, so jobs that need one of them wait for it instead of parsing
+        // it again. the lock is only held to look them up, not while parsing.
+
+        struct Loading {
+            bool done = false;
+            QSharedPointer<Archive> archive;
+            QString error;
+        };
+
+        QHash<QString, QSharedPointer<Loading>> loading;
+        QWaitCondition archiveLoaded;
+
+        // shared by every client, so one big job can't starve the machine
+
+        QThreadPool pool;
+        std::atomic<int> queued { 0 };
+        std::atomic<int> running { 0 };
+};
+
+#endif // NDAEMON_H
@@ -0,0 +1,474 @@
+#include "NEntryReader.h"
+#include "NUTFSchema.h"
+#include "NCRILAYLA.h"
+#include "NTrace.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QHash>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace {
+
+    // write-only device that drops the first `skip` bytes, keeps the next `limit`
+    // and then refuses any further writes, so a streaming reader stops decoding early
+
+    class NBoundedBuffer : public QIODevice {
+        public:
+            NBoundedBuffer(qint64 skip, qint64 limit) : skip(skip), limit(limit) {
+                open(QIODevice::WriteOnly);
+            }
+
+            QByteArray data() const { return buffer; }
+
+        protected:
+            qint64 readData(char*, qint64) override {
+                return -1;
+            }
+
+            qint64 writeData(const char* data, qint64 len) override {
+                if (skip > 0) {
+                    qint64 skipped = qMin(len, skip);
+
+                    skip -= skipped;
+                    data += skipped;
+
+                    if (skipped == len)
+                        return len;
+
+                    qint64 kept = writeData(data, len - skipped);
+
+                    return (kept < 0) ? kept : skipped + kept;
+                }
+
+                qint64 remaining = limit - buffer.size();
+
+                if (remaining <= 0)
+                    return -1;
+
+                qint64 taken = qMin(len, remaining);
+                buffer.append(data, static_cast<int>(taken));
+
+                return taken;
+            }
+
+        private:
+            qint64 skip;
+            qint64 limit;
+            QByteArray buffer;
+    };
+
+    // write-only device that checks everything written to it against another device,
+    // refusing the first write that differs so the reader stops there
+
+    class NComparingDevice : public QIODevice {
+        public:
+            explicit NComparingDevice(QIODevice* expected) : expected(expected) {
+                open(QIODevice::WriteOnly);
+            }
+
+            bool matched() const { return same; }
+
+        protected:
+            qint64 readData(char*, qint64) override {
+                return -1;
+            }
+
+            qint64 writeData(const char* data, qint64 len) override {
+                QByteArray other = expected->read(len);
+
+                if (other.size() != len || std::memcmp(other.constData(), data, static_cast<size_t>(len)) != 0) {
+                    same = false;
+                    return -1;
+                }
+
+                return len;
+            }
+
+        private:
+            QIODevice* expected;
+            bool same = true;
+    };
+
+    // a cpk chunk: magic, 4 unknown bytes, 64-bit little-endian size and the @UTF table
+
+    QByteArray readChunk(QFile& archive, qint64 offset, const char* magic) {
+        if (!archive.seek(offset))
+            return QByteArray();
+
+        QByteArray header = archive.read(0x10);
+
+        if (header.size() < 0x10 || !header.startsWith(magic))
+            return QByteArray();
+
+        quint64 size = qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(header.constData()) + 8);
+
+        if (size > static_cast<quint64>(archive.size()))
+            return QByteArray();
+
+        return archive.read(static_cast<qint64>(size));
+    }
+}
+
+NEntryReader::NEntryReader(LibNao::FileType type, const QString& archive,
+                           NaoCRIWareReader* criware, NaoDATReader* dat)
+    : fileType(type),
+    archivePath(archive),
+    CRIWareReader(criware),
+    PG_DATReader(dat) {
+
+    if (fileType == LibNao::CRIWare && CRIWareReader->isPak())
+        locateEntries();
+}
+
+void NEntryReader::locateEntries() {
+    NAO_TRACE("locate");
+
+    QFile archive(archivePath);
+
+    if (!archive.open(QIODevice::ReadOnly))
+        return;
+
+    NUTFTable header(readChunk(archive, 0, "CPK "));
+
+    if (!header.isValid() || header.rowCount() != 1)
+        return;
+
+    const qint64 tocOffset = header.value(0, "TocOffset").toLongLong();
+    const qint64 contentOffset = header.value(0, "ContentOffset").toLongLong();
+
+    QVector<NTOCRow> rows;
+
+    if (tocOffset <= 0 || !NTOCSchema::read(NUTFTable(readChunk(archive, tocOffset, "TOC ")), rows))
+        return;
+
+    // file offsets count from whichever comes first
+
+    const qint64 base = (contentOffset > 0) ? qMin(tocOffset, contentOffset) : tocOffset;
+
+    // the reader doesn't tell us which row an entry came from. it lists them in TOC order,
+    // so the same position is tried first and only the stragglers are matched on the full name
+
+    const QVector<NaoCRIWareReader::EmbeddedFile>& files = CRIWareReader->getFiles();
+    QHash<QString, int> byPath;
+
+    locations.fill({ 0, -1, -1 }, files.size());
+
+    for (int i = 0; i < files.size(); ++i) {
+        const NaoCRIWareReader::EmbeddedFile& file = files.at(i);
+        int row = -1;
+
+        if (i < rows.size() && rows.at(i).fileName == file.name.toUtf8() && rows.at(i).dirName == file.path.toUtf8()) {
+            row = i;
+        } else {
+            if (byPath.isEmpty()) {
+                for (int r = 0; r < rows.size(); ++r) {
+                    const NTOCRow& candidate = rows.at(r);
+
+                    byPath.insert((candidate.dirName.isEmpty() ? "" : QString::fromUtf8(candidate.dirName) + "/") +
+                                  QString::fromUtf8(candidate.fileName), r);
+                }
+            }
+
+            row = byPath.value((file.path.isEmpty() ? "" : file.path + "/") + file.name, -1);
+        }
+
+        if (row >= 0 && rows.at(row).extractSize == file.extractedSize)
+            locations[i] = { base + rows.at(row).fileOffset, rows.at(row).fileSize, rows.at(row).extractSize };
+    }
+}
+
+QByteArray NEntryReader::readDirect(const Location& location, qint64 offset, qint64 length) const {
+    QFile archive(archivePath);
+
+    if (!archive.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    // stored as-is
+
+    if (location.size == location.extractSize) {
+        if (!archive.seek(location.offset + offset))
+            return QByteArray();
+
+        return archive.read(length);
+    }
+
+    if (!archive.seek(location.offset))
+        return QByteArray();
+
+    QByteArray header = archive.read(NCRILAYLA::HeaderSize);
+    qint64 prefix = NCRILAYLA::prefixPosition(header);
+
+    if (prefix < 0)
+        return QByteArray();
+
+    // the first bytes are stored raw behind the compressed stream
+
+    if (offset + length <= NCRILAYLA::PrefixSize) {
+        if (!archive.seek(location.offset + prefix + offset))
+            return QByteArray();
+
+        return archive.read(length);
+    }
+
+    // the rest is decoded from the end, but no further than the range starts
+
+    NAO_TRACE("decompress");
+
+    return NCRILAYLA::decompress(header + archive.read(location.size - header.size()), offset, length);
+}
+
+qint64 NEntryReader::count() const {
+    switch (fileType) {
+        case LibNao::CRIWare:
+            return CRIWareReader->getFiles().size();
+
+        case LibNao::PG_DAT:
+            return PG_DATReader->getFiles().size();
+
+        default:
+            return 0;
+    }
+}
+
+qint64 NEntryReader::entrySize(qint64 index) const {
+    switch (fileType) {
+        case LibNao::CRIWare: {
+            const NaoCRIWareReader::EmbeddedFile& file = CRIWareReader->getFiles().at(index);
+
+            // usm streams have no separate extracted size
+
+            return CRIWareReader->isPak() ? file.extractedSize : file.size;
+        }
+
+        case LibNao::PG_DAT:
+            return PG_DATReader->getFiles().at(index).size;
+
+        default:
+            return 0;
+    }
+}
+
+QString NEntryReader::path(qint64 index) const {
+    switch (fileType) {
+        case LibNao::CRIWare: {
+            const NaoCRIWareReader::EmbeddedFile& file = CRIWareReader->getFiles().at(index);
+
+            if (CRIWareReader->isPak())
+                return (file.path.isEmpty() ? "" : file.path + "/") + LibNao::Utils::sanitizeFileName(file.name);
+
+            // usm streams get the extension of what they actually contain
+
+            return LibNao::Utils::sanitizeFileName(QFileInfo(file.name).baseName()) +
+                    ((file.type == NaoCRIWareReader::EmbeddedFile::Video) ? ".mpeg" : ".adx");
+        }
+
+        case LibNao::PG_DAT:
+            return PG_DATReader->getFiles().at(index).name;
+
+        default:
+            return QString();
+    }
+}
+
+NEntryReader::Info NEntryReader::info(qint64 index) const {
+    Info result = { path(index), "File", 0, 0, 0, 0, 0 };
+
+    switch (fileType) {
+        case LibNao::CRIWare: {
+            const NaoCRIWareReader::EmbeddedFile& file = CRIWareReader->getFiles().at(index);
+
+            result.offset = file.offset;
+            result.size = file.size;
+            result.extractedSize = entrySize(index);
+
+            if (CRIWareReader->isPak()) {
+                result.extraOffset = file.extraOffset;
+            } else {
+                result.type = (file.type == NaoCRIWareReader::EmbeddedFile::Video) ? "Video" : "Audio";
+                result.bitrate = file.avbps;
+            }
+
+            break;
+        }
+
+        case LibNao::PG_DAT: {
+            const NaoDATReader::EmbeddedFile& file = PG_DATReader->getFiles().at(index);
+
+            result.offset = file.offset;
+            result.size = file.size;
+            result.extractedSize = file.size;
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return result;
+}
+
+QByteArray NEntryReader::read(qint64 index, qint64 maxBytes) {
+    return read(index, 0, maxBytes);
+}
+
+QByteArray NEntryReader::read(qint64 index, qint64 offset, qint64 length) {
+    qint64 size = entrySize(index);
+
+    if (offset < 0 || offset >= size)
+        return QByteArray();
+
+    if (length < 0 || length > size - offset)
+        length = size - offset;
+
+    if (length == 0)
+        return QByteArray();
+
+    switch (fileType) {
+        case LibNao::PG_DAT: {
+
+            // dat entries are stored as-is, so we can read them straight from the archive
+            // with our own handle and don't need to touch the reader at all
+
+            const NaoDATReader::EmbeddedFile& file = PG_DATReader->getFiles().at(index);
+
+            QFile archive(archivePath);
+
+            if (!archive.open(QIODevice::ReadOnly) || !archive.seek(file.offset + offset))
+                return QByteArray();
+
+            return archive.read(length);
+        }
+
+        case LibNao::CRIWare: {
+
+            // no need to go through the (locked) reader if we know where the entry is
+
+            if (index < locations.size() && locations.at(index).size >= 0) {
+                QByteArray result = readDirect(locations.at(index), offset, length);
+
+                if (result.size() == length)
+                    return result;
+            }
+
+            QMutexLocker lock(&readerMutex);
+
+            NBoundedBuffer buffer(offset, length);
+
+            // the result is expected to be false when we cut the entry short
+
+            CRIWareReader->extractFileTo(index, &buffer);
+
+            return buffer.data();
+        }
+
+        default:
+            return QByteArray();
+    }
+}
+
+bool NEntryReader::readTo(qint64 index, QIODevice* device) {
+    switch (fileType) {
+        case LibNao::PG_DAT: {
+            const qint64 chunkSize = 4 << 20;
+            const NaoDATReader::EmbeddedFile& file = PG_DATReader->getFiles().at(index);
+
+            QFile archive(archivePath);
+
+            if (!archive.open(QIODevice::ReadOnly) || !archive.seek(file.offset))
+                return false;
+
+            for (qint64 remaining = file.size; remaining > 0; ) {
+                QByteArray chunk = archive.read(qMin(remaining, chunkSize));
+
+                if (chunk.isEmpty() || device->write(chunk) != chunk.size())
+                    return false;
+
+                remaining -= chunk.size();
+            }
+
+            return true;
+        }
+
+        case LibNao::CRIWare: {
+            QMutexLocker lock(&readerMutex);
+
+            return CRIWareReader->extractFileTo(index, device);
+        }
+
+        default:
+            return false;
+    }
+}
+
+bool NEntryReader::sameContents(qint64 index, const QString& file) {
+    QFile other(file);
+
+    if (other.size() != entrySize(index) || !other.open(QIODevice::ReadOnly))
+        return false;
+
+    NComparingDevice compare(&other);
+
+    return readTo(index, &compare) && compare.matched() && other.atEnd();
+}
+
+bool NEntryReader::hasStoredData(qint64 index) const {
+    switch (fileType) {
+        case LibNao::PG_DAT:
+            return true;
+
+        case LibNao::CRIWare:
+            return index < locations.size() && locations.at(index).size >= 0;
+
+        default:
+            return false;
+    }
+}
+
+bool NEntryReader::hasRandomAccess(qint64 index) const {
+    switch (fileType) {
+        case LibNao::PG_DAT:
+            return true;
+
+        case LibNao::CRIWare:
+            return hasStoredData(index) && locations.at(index).size == locations.at(index).extractSize;
+
+        default:
+            return false;
+    }
+}
+
+QByteArray NEntryReader::readStored(qint64 index) const {
+    qint64 offset;
+    qint64 size;
+
+    if (fileType == LibNao::PG_DAT) {
+        const NaoDATReader::EmbeddedFile& file = PG_DATReader->getFiles().at(index);
+
+        offset = file.offset;
+        size = file.size;
+    } else if (hasStoredData(index)) {
+        offset = locations.at(index).offset;
+        size = locations.at(index).size;
+    } else {
+        return QByteArray();
+    }
+
+    QFile archive(archivePath);
+
+    if (!archive.open(QIODevice::ReadOnly) || !archive.seek(offset))
+        return QByteArray();
+
+    return archive.read(size);
+}
+
+QByteArray NEntryReader::decodeStored(qint64 index, const QByteArray& stored) const {
+    if (fileType != LibNao::CRIWare || !hasStoredData(index) ||
+            locations.at(index).size == locations.at(index).extractSize)
+        return stored;
+
+    return NCRILAYLA::decompress(stored);
+}
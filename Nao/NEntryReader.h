@@ -0,0 +1,111 @@
+#ifndef NENTRYREADER_H
+#define NENTRYREADER_H
+
+#include <QMutex>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+#include <libnao.h>
+#include <NaoCRIWareReader.h>
+#include <NaoDATReader.h>
+
+// thread-safe access to the entries of the currently loaded archive,
+// reading only as many bytes as the caller asks for
+
+class NEntryReader {
+    public:
+
+        // everything the readers know about an entry, without its contents
+
+        struct Info {
+            QString path;
+            QString type;       // "File", "Video" or "Audio"
+            qint64 offset;
+            qint64 extraOffset;
+            qint64 size;        // as stored
+            qint64 extractedSize;
+            qint64 bitrate;     // usm streams only
+        };
+
+        NEntryReader(LibNao::FileType type, const QString& archive,
+                     NaoCRIWareReader* criware, NaoDATReader* dat);
+
+        // entries up to this size may be held in memory whole
+
+        static const qint64 BufferLimit = 64 << 20;
+
+        LibNao::FileType type() const { return fileType; }
+        QString archive() const { return archivePath; }
+
+        qint64 count() const;
+        qint64 entrySize(qint64 index) const; // size after extraction
+
+        // relative path the entry is extracted to
+
+        QString path(qint64 index) const;
+
+        Info info(qint64 index) const;
+
+        // read at most maxBytes (or everything if negative) from the start of an entry
+
+        QByteArray read(qint64 index, qint64 maxBytes = -1);
+
+        // read at most length bytes (or up to the end if negative) starting at offset.
+        // stored entries are read in place. compressed cpk entries keep their first 0x100
+        // bytes raw, so a range within those decodes nothing. any range reaching past them
+        // reads the whole stored entry and decodes it from the end down to offset, which for
+        // a range starting near the front is nearly the whole entry.
+
+        QByteArray read(qint64 index, qint64 offset, qint64 length);
+
+        // stream a whole entry into a device without holding it in memory
+
+        bool readTo(qint64 index, QIODevice* device);
+
+        // whether a file holds exactly the contents of an entry. sizes are compared first,
+        // then the entry is read only up to the first byte that differs.
+
+        bool sameContents(qint64 index, const QString& file);
+
+        // entries whose stored bytes we can get at without the reader. these can be read
+        // and decoded as two separate steps, and from any number of threads at once.
+
+        bool hasStoredData(qint64 index) const;
+        QByteArray readStored(qint64 index) const;
+        QByteArray decodeStored(qint64 index, const QByteArray& stored) const;
+
+        // entries that are stored as-is, so reading from the middle costs no more than the
+        // bytes read. everything else is decoded from one end or the other.
+
+        bool hasRandomAccess(qint64 index) const;
+
+    private:
+
+        // where a cpk entry is in the archive, found through our own TOC parse
+
+        struct Location {
+            qint64 offset;
+            qint64 size;
+            qint64 extractSize;
+        };
+
+        void locateEntries();
+        QByteArray readDirect(const Location& location, qint64 offset, qint64 length) const;
+
+        LibNao::FileType fileType;
+        QString archivePath;
+
+        NaoCRIWareReader* CRIWareReader;
+        NaoDATReader* PG_DATReader;
+
+        // empty if the TOC couldn't be read, size < 0 for entries we couldn't match
+
+        QVector<Location> locations;
+
+        // the readers themselves are not reentrant
+
+        QMutex readerMutex;
+};
+
+#endif // NENTRYREADER_H
@@ -0,0 +1,694 @@
+#include "NExtractor.h"
+#include "NHashingDevice.h"
+#include "NConcurrencyTuner.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <QThread>
+#include <QCoreApplication>
+#include <QHash>
+#include <QSettings>
+#include <QStorageInfo>
+#include <QElapsedTimer>
+#include <QBuffer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+#include <functional>
+#include <cerrno>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+namespace {
+
+    // fn(0) ... fn(count - 1) on at most `threads` threads of the pool, traced as part of job.
+    // the pool is shared, so this job's share of it is the number of workers, not its size.
+
+    void parallelFor(NTraceJob* job, QThreadPool* pool, int threads, int count, const std::function<void(int)>& fn) {
+        std::atomic<int> next(0);
+        QVector<QFuture<void>> workers;
+
+        for (int t = 0; t < qMin(threads, count); ++t) {
+            workers.append(QtConcurrent::run(pool, [&]() {
+                NTraceJob::Attach attach(job);
+
+                for (int i = next++; i < count; i = next++)
+                    fn(i);
+            }));
+        }
+
+        for (QFuture<void>& worker : workers)
+            worker.waitForFinished();
+    }
+
+    double rate(qint64 bytes, qint64 nsecs) {
+        return (nsecs > 0) ? bytes * 1e9 / nsecs : 0.;
+    }
+
+    // one pool per device and direction for the whole process, so extractions running at
+    // the same time (a retry, daemon jobs) share a disk's threads instead of each adding theirs
+
+    QThreadPool* devicePool(const QString& key, int maxThreads) {
+        static QMutex mutex;
+        static QHash<QString, QThreadPool*> pools;
+
+        QMutexLocker lock(&mutex);
+        QThreadPool*& pool = pools[key];
+
+        if (!pool) {
+            pool = new QThreadPool(QCoreApplication::instance());
+            pool->setMaxThreadCount(maxThreads);
+        }
+
+        return pool;
+    }
+}
+
+NExtractor::NExtractor(NEntryReader* reader, const QString& output, const QVector<qint64>& indices)
+    : QObject(),
+    reader(reader),
+    outdir(output),
+    modified(QFileInfo(reader->archive()).lastModified()),
+    indices(indices) {
+
+}
+
+void NExtractor::setRange(qint64 offset, qint64 length) {
+    ranged = true;
+    rangeOffset = qMax(0LL, offset);
+    rangeLength = length;
+}
+
+qint64 NExtractor::entryBytes(qint64 index) const {
+    qint64 size = reader->entrySize(index);
+
+    if (!ranged)
+        return size;
+
+    qint64 available = qMax(0LL, size - rangeOffset);
+
+    return (rangeLength < 0) ? available : qMin(available, rangeLength);
+}
+
+void NExtractor::run() {
+    failed.clear();
+    written = 0;
+    deduplicated = 0;
+
+    trace.clear();
+    NTraceJob::Attach attach(&trace);
+
+    // ranges are cheaper through NEntryReader::read(), and the parallel path holds whole
+    // entries in memory, so only what we can read ourselves and is small enough goes there.
+    // larger entries are streamed one at a time.
+
+    QVector<qint64> direct;
+    QVector<qint64> sequential;
+
+    for (qint64 index : indices) {
+        bool parallel = !ranged && reader->hasStoredData(index) && reader->entrySize(index) <= BufferLimit;
+
+        (parallel ? direct : sequential).append(index);
+    }
+
+    sequential += runParallel(direct);
+
+    for (qint64 index : sequential)
+        extractWithRetries(index);
+}
+
+void NExtractor::extractWithRetries(qint64 index) {
+    QString path = reader->path(index);
+    QString target = outdir.absoluteFilePath(path);
+    QString reason;
+    bool transient = false;
+    int attempt = 0;
+
+    while (attempt < MaxAttempts) {
+
+        // back off before retrying, a busy share or full cache often recovers
+
+        if (attempt > 0) {
+            NAO_TRACE("backoff");
+            QThread::msleep(BackoffMs << (attempt - 1));
+        }
+
+        ++attempt;
+
+        if (extractEntry(index, target, reason, transient) || !transient)
+            break;
+    }
+
+    if (!reason.isEmpty())
+        failed.append({ index, path, reason, attempt });
+
+    NAO_TRACE("signal");
+    emit progress(entryBytes(index));
+}
+
+QVector<qint64> NExtractor::runParallel(const QVector<qint64>& entries) {
+    QVector<qint64> retry;
+
+    if (entries.isEmpty())
+        return retry;
+
+    // the output has to exist before we can tell which device it's on
+
+    QDir().mkpath(outdir.absolutePath());
+
+    const QString readKey = "concurrency/read/" + deviceKey(reader->archive());
+    const QString writeKey = "concurrency/write/" + deviceKey(outdir.absolutePath());
+    const int cores = QThread::idealThreadCount();
+
+    // reading is tuned for the source device, decoding and writing for the cores and target device
+
+    QSettings settings("Nao", "Nao");
+
+    NConcurrencyTuner readTuner(2, 1, MaxReadThreads, settings.value(readKey).toInt());
+    NConcurrencyTuner writeTuner(cores, 1, cores * 2, settings.value(writeKey).toInt());
+
+    QVector<QVector<qint64>> waves(1);
+    qint64 waveBytes = 0;
+
+    // an entry larger than a wave gets one to itself
+
+    for (qint64 index : entries) {
+        qint64 size = reader->entrySize(index);
+
+        if (!waves.last().isEmpty() && (waveBytes + size > WaveBytes || waves.last().size() >= WaveEntries)) {
+            waves.append(QVector<qint64>());
+            waveBytes = 0;
+        }
+
+        waves.last().append(index);
+        waveBytes += size;
+    }
+
+    QThreadPool* readPool = devicePool(readKey, MaxReadThreads);
+    QThreadPool* writePool = devicePool(writeKey, cores * 2);
+    QElapsedTimer tuning;
+    tuning.start();
+
+    // the first wave is read on its own, into cold caches and while the pool spins up its
+    // threads. its rate says little about the thread count, so the tuner starts with the next
+
+    ReadRound current = readWave(waves.first(), readPool, readTuner.value());
+
+    for (int w = 0; w < waves.size(); ++w) {
+        const QVector<qint64>& wave = waves.at(w);
+        const bool tune = tuning.elapsed() < TuneMs;
+        QFuture<ReadRound> next;
+
+        // read the next wave while this one is written
+
+        if (w + 1 < waves.size())
+            next = QtConcurrent::run(this, &NExtractor::readWave, waves.at(w + 1), readPool, readTuner.value());
+
+        QVector<char> succeeded(wave.size(), 0);
+        double writeRate = writeWave(wave, current.stored, writePool, writeTuner.value(), succeeded);
+
+        if (tune)
+            writeTuner.report(writeRate);
+
+        for (int i = 0; i < wave.size(); ++i) {
+            if (succeeded.at(i)) {
+                NAO_TRACE("signal");
+                emit progress(entryBytes(wave.at(i)));
+            } else {
+                retry.append(wave.at(i));
+            }
+        }
+
+        if (w + 1 < waves.size()) {
+            current = next.result();
+
+            if (tune)
+                readTuner.report(current.rate);
+        }
+    }
+
+    // only a finished search is worth remembering, and a remembered value isn't searched again
+
+    if (readTuner.isSettled() && readTuner.hasMeasured())
+        settings.setValue(readKey, readTuner.best());
+
+    if (writeTuner.isSettled() && writeTuner.hasMeasured())
+        settings.setValue(writeKey, writeTuner.best());
+
+    return retry;
+}
+
+NExtractor::ReadRound NExtractor::readWave(const QVector<qint64>& wave, QThreadPool* pool, int threads) {
+    ReadRound round = { QVector<QByteArray>(wave.size()), 0. };
+    QByteArray* stored = round.stored.data();
+    std::atomic<qint64> bytes(0);
+    QElapsedTimer timer;
+    timer.start();
+
+    parallelFor(&trace, pool, threads, wave.size(), [&](int i) {
+        NAO_TRACE("read");
+
+        stored[i] = reader->readStored(wave.at(i));
+        bytes += stored[i].size();
+    });
+
+    round.rate = rate(bytes, timer.nsecsElapsed());
+
+    return round;
+}
+
+double NExtractor::writeWave(const QVector<qint64>& wave, const QVector<QByteArray>& stored,
+                             QThreadPool* pool, int threads, QVector<char>& succeeded) {
+    char* result = succeeded.data();
+    std::atomic<qint64> bytes(0);
+    QElapsedTimer timer;
+    timer.start();
+
+    parallelFor(&trace, pool, threads, wave.size(), [&](int i) {
+        qint64 index = wave.at(i);
+        QByteArray data;
+
+        {
+            NAO_TRACE("decompress");
+            data = reader->decodeStored(index, stored.at(i));
+        }
+
+        // a failed entry gets retried the slow way, which reports why
+
+        QString target = outdir.absoluteFilePath(reader->path(index));
+        QString reason;
+        bool transient = false;
+
+        result[i] = (data.size() == reader->entrySize(index)) &&
+                makeDirectory(target, reason, transient) && writeData(target, data, reason, transient);
+
+        bytes += data.size();
+    });
+
+    return rate(bytes, timer.nsecsElapsed());
+}
+
+QString NExtractor::deviceKey(const QString& path) {
+    QStorageInfo storage(path);
+    QString device = QString::fromUtf8(storage.device());
+
+    if (!storage.isValid() || device.isEmpty())
+        device = "unknown";
+
+    // slashes would make groups out of it
+
+    return device.replace('/', '_').replace('\\', '_');
+}
+
+bool NExtractor::makeDirectory(const QString& target, QString& reason, bool& transient) {
+    QString dir = QFileInfo(target).absolutePath();
+    QMutexLocker lock(&dirMutex);
+
+    if (createdDirs.contains(dir))
+        return true;
+
+    if (!outdir.mkpath(dir)) {
+        int error = systemError();
+
+        reason = "Could not create directory " + dir + ": " + qt_error_string(error);
+        transient = isTransient(error);
+        return false;
+    }
+
+    createdDirs.insert(dir);
+
+    return true;
+}
+
+bool NExtractor::extractEntry(qint64 index, const QString& target, QString& reason, bool& transient) {
+    reason.clear();
+    transient = false;
+
+    if (!makeDirectory(target, reason, transient))
+        return false;
+
+    return store ? storeEntry(index, target, reason, transient) : writeEntry(index, target, reason, transient);
+}
+
+bool NExtractor::writeEntry(qint64 index, const QString& target, QString& reason, bool& transient) {
+    QFile outfile(target);
+
+    {
+        NAO_TRACE("open");
+
+        if (!outfile.open(QIODevice::WriteOnly)) {
+            transient = isTransient(systemError());
+            reason = "Could not open for writing: " + outfile.errorString();
+            return false;
+        }
+    }
+
+    bool success;
+
+    if (reader->type() == LibNao::CRIWare && entryBytes(index) <= BufferLimit) {
+
+        // decode into memory first, so decoding and writing show up as separate stages
+
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+
+        {
+            NAO_TRACE("decompress");
+            success = readEntry(index, &buffer);
+        }
+
+        NAO_TRACE("write");
+
+        success = success && (outfile.write(buffer.data()) == buffer.size());
+    } else {
+
+        // dat entries are stored uncompressed, so this is the read and write stage in one.
+        // larger cpk entries are streamed the same way instead of held in memory
+
+        NAO_TRACE("write");
+
+        success = readEntry(index, &outfile);
+    }
+
+    success = outfile.flush() && success;
+
+    if (!success) {
+        readFailure(outfile, systemError(), reason, transient);
+
+        outfile.close();
+        outfile.remove();
+
+        return false;
+    }
+
+    // a range isn't the entry, so it mustn't look like an untouched copy of it
+
+    if (!ranged)
+        outfile.setFileTime(modified, QFileDevice::FileModificationTime);
+
+    written += outfile.size();
+    outfile.close();
+
+    return true;
+}
+
+bool NExtractor::storeEntry(qint64 index, const QString& target, QString& reason, bool& transient) {
+    if (entryBytes(index) <= BufferLimit) {
+
+        // hash in memory first, a duplicate then costs no writes at all
+
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+
+        {
+            NAO_TRACE("decompress");
+
+            if (!readEntry(index, &buffer)) {
+                reason = "Could not read the entry from the archive";
+                transient = true;
+                return false;
+            }
+        }
+
+        return storeData(target, buffer.data(), reason, transient);
+    }
+
+    // too large to hold, stream it into the store and hash along the way
+
+    QTemporaryFile staged(store->stagingTemplate());
+
+    {
+        NAO_TRACE("open");
+
+        if (!staged.open()) {
+            transient = isTransient(systemError());
+            reason = "Could not create a file in the store: " + staged.errorString();
+            return false;
+        }
+    }
+
+    NHashingDevice hashing(&staged);
+
+    {
+        NAO_TRACE("write");
+
+        if (!readEntry(index, &hashing) || !staged.flush()) {
+            readFailure(staged, systemError(), reason, transient);
+            return false;
+        }
+    }
+
+    QByteArray hash = hashing.result();
+    int code = 0;
+
+    if (store->contains(hash)) {
+        deduplicated += hashing.bytesHashed();
+    } else {
+        if (!store->insert(hash, staged, reason, code)) {
+            transient = isTransient(code);
+            return false;
+        }
+
+        written += hashing.bytesHashed();
+    }
+
+    NAO_TRACE("link");
+
+    if (NBlobStore::link(store->blobPath(hash), target, reason, code) == NBlobStore::Failed) {
+        transient = isTransient(code);
+        return false;
+    }
+
+    return true;
+}
+
+bool NExtractor::readEntry(qint64 index, QIODevice* device) {
+    if (!ranged)
+        return reader->readTo(index, device);
+
+    // ranges go through read(), which only decodes as much as it has to. large ones are
+    // read a buffer at a time, a QByteArray can't hold more than 2 GiB.
+
+    const qint64 length = entryBytes(index);
+    const qint64 chunkSize = BufferLimit;
+
+    for (qint64 done = 0; done < length; ) {
+        QByteArray data = reader->read(index, rangeOffset + done, qMin(length - done, chunkSize));
+
+        if (data.isEmpty() || device->write(data) != data.size())
+            return false;
+
+        done += data.size();
+    }
+
+    return true;
+}
+
+bool NExtractor::writeData(const QString& target, const QByteArray& data, QString& reason, bool& transient) {
+    if (store)
+        return storeData(target, data, reason, transient);
+
+    QFile outfile(target);
+
+    {
+        NAO_TRACE("open");
+
+        if (!outfile.open(QIODevice::WriteOnly)) {
+            transient = isTransient(systemError());
+            reason = "Could not open for writing: " + outfile.errorString();
+            return false;
+        }
+    }
+
+    NAO_TRACE("write");
+
+    if (outfile.write(data) != data.size() || !outfile.flush()) {
+        readFailure(outfile, systemError(), reason, transient);
+
+        outfile.close();
+        outfile.remove();
+
+        return false;
+    }
+
+    if (!ranged)
+        outfile.setFileTime(modified, QFileDevice::FileModificationTime);
+
+    written += data.size();
+
+    return true;
+}
+
+bool NExtractor::storeData(const QString& target, const QByteArray& data, QString& reason, bool& transient) {
+    QByteArray hash;
+    int code = 0;
+
+    {
+        NAO_TRACE("hash");
+        hash = QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+    }
+
+    if (store->contains(hash)) {
+        deduplicated += data.size();
+    } else {
+        NAO_TRACE("write");
+
+        if (!store->insert(hash, data, reason, code)) {
+            transient = isTransient(code);
+            return false;
+        }
+
+        written += data.size();
+    }
+
+    NAO_TRACE("link");
+
+    if (NBlobStore::link(store->blobPath(hash), target, reason, code) == NBlobStore::Failed) {
+        transient = isTransient(code);
+        return false;
+    }
+
+    return true;
+}
+
+void NExtractor::readFailure(const QFileDevice& file, int error, QString& reason, bool& transient) {
+
+    // an error on our side has an error string, otherwise the archive was the problem
+
+    if (file.error() != QFileDevice::NoError) {
+        reason = "Could not write: " + file.errorString();
+        transient = isTransient(error);
+    } else {
+        reason = "Could not read the entry from the archive";
+        transient = true;
+    }
+}
+
+int NExtractor::systemError() {
+#ifdef Q_OS_WIN
+    return static_cast<int>(GetLastError());
+#else
+    return errno;
+#endif
+}
+
+bool NExtractor::isTransient(int error) {
+
+    // QFileDevice folds most of these into one OpenError or WriteError, but retrying
+    // won't give us permission, space or a shorter name
+
+    switch (error) {
+#ifdef Q_OS_WIN
+        case ERROR_ACCESS_DENIED:
+        case ERROR_WRITE_PROTECT:
+        case ERROR_DISK_FULL:
+        case ERROR_HANDLE_DISK_FULL:
+        case ERROR_FILENAME_EXCED_RANGE:
+        case ERROR_INVALID_NAME:
+        case ERROR_DIRECTORY:
+#else
+        case EACCES:
+        case EPERM:
+        case EROFS:
+        case ENOSPC:
+        case ENAMETOOLONG:
+        case EDQUOT:
+        case ENOTDIR:
+        case EISDIR:
+#endif
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+QVector<qint64> NExtractor::failedIndices() const {
+    QVector<qint64> result;
+
+    for (const Failure& f : failed)
+        result.append(f.index);
+
+    return result;
+}
+
+QString NExtractor::report() const {
+    QString result;
+
+    for (const Failure& f : failed) {
+        result += QString("%0: %1 (%2 attempt%3)\n")
+                .arg(f.path, f.reason)
+                .arg(f.attempts)
+                .arg((f.attempts == 1) ? "" : "s");
+    }
+
+    return result;
+}
+
+QByteArray NExtractor::failureList() const {
+    QJsonArray entries;
+
+    for (const Failure& f : failed) {
+        entries.append(QJsonObject {
+            { "index", f.index },
+            { "path", f.path },
+            { "reason", f.reason },
+            { "attempts", f.attempts }
+        });
+    }
+
+    return QJsonDocument(QJsonObject {
+        { "archive", QFileInfo(reader->archive()).absoluteFilePath() },
+        { "output", outdir.absolutePath() },
+        { "failures", entries }
+    }).toJson();
+}
+
+bool NExtractor::readFailureList(const QByteArray& json, QString& archive, QString& output,
+                                 QVector<Failure>& failures, QString& error) {
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(json, &parseError);
+
+    if (!document.isObject()) {
+        error = (parseError.error != QJsonParseError::NoError) ? parseError.errorString() : "Not an object";
+        return false;
+    }
+
+    QJsonObject object = document.object();
+
+    archive = object.value("archive").toString();
+    output = object.value("output").toString();
+
+    if (archive.isEmpty() || output.isEmpty() || !object.value("failures").isArray()) {
+        error = "Not a failure list";
+        return false;
+    }
+
+    failures.clear();
+
+    for (const QJsonValue& value : object.value("failures").toArray()) {
+        QJsonObject entry = value.toObject();
+
+        // the path is what matters, the index is only a hint
+
+        if (!entry.value("path").isString()) {
+            error = "An entry has no path";
+            return false;
+        }
+
+        failures.append({
+            static_cast<qint64>(entry.value("index").toDouble(-1)),
+            entry.value("path").toString(),
+            entry.value("reason").toString(),
+            entry.value("attempts").toInt()
+        });
+    }
+
+    return true;
+}
@@ -0,0 +1,180 @@
+#ifndef NEXTRACTOR_H
+#define NEXTRACTOR_H
+
+#include <QObject>
+#include <QVector>
+#include <QSet>
+#include <QDir>
+#include <QDateTime>
+#include <QFileDevice>
+#include <QThreadPool>
+#include <QMutex>
+
+#include <atomic>
+
+#include "NEntryReader.h"
+#include "NBlobStore.h"
+#include "NTrace.h"
+
+// extracts a set of entries into a directory. a failing entry doesn't stop the job:
+// transient I/O errors are retried with exponential backoff, everything that still
+// fails is collected so it can be reported and retried on its own.
+//
+// entries whose stored data we can read ourselves, up to BufferLimit, are read and
+// decoded/written in waves on two pools per device that every extraction shares.
+// during the first seconds both thread counts are tuned for throughput, and the result
+// is remembered for the source and target device. larger entries are streamed.
+//
+// written files get the archive's modification time, so repacking can skip the ones
+// nobody touched by size and time alone. linked blobs are shared and keep their own.
+
+class NExtractor : public QObject {
+        Q_OBJECT
+
+    public:
+        struct Failure {
+            qint64 index;
+            QString path;
+            QString reason;
+            int attempts;
+        };
+
+        NExtractor(NEntryReader* reader, const QString& output, const QVector<qint64>& indices);
+
+        // blocking, meant to be run on a worker thread
+
+        void run();
+
+        // deduplicate into a content-addressed store instead of writing every copy
+
+        void setStore(NBlobStore* blobStore) { store = blobStore; }
+
+        // extract only length bytes (up to the end if negative) from offset in every entry
+
+        void setRange(qint64 offset, qint64 length);
+
+        // how much of an entry ends up on disk
+
+        qint64 entryBytes(qint64 index) const;
+
+        const QVector<qint64>& entries() const { return indices; }
+        const QVector<Failure>& failures() const { return failed; }
+
+        // indices of the failed entries, to retry just those
+
+        QVector<qint64> failedIndices() const;
+
+        // one line per failed entry, for display or saving
+
+        QString report() const;
+
+        // the failures as a JSON document with the archive and output directory, so a later
+        // session can load it back with readFailureList() and retry just those entries
+
+        QByteArray failureList() const;
+
+        static bool readFailureList(const QByteArray& json, QString& archive, QString& output,
+                                    QVector<Failure>& failures, QString& error);
+
+        qint64 bytesWritten() const { return written; }
+
+        // bytes that were linked to an already stored blob instead of written
+
+        qint64 bytesDeduplicated() const { return deduplicated; }
+
+        // time per stage of the last run, when tracing is on
+
+        QString traceSummary() const { return trace.summary(); }
+
+        static const int MaxAttempts = 4;
+        static const int BackoffMs = 100; // doubled every attempt
+
+        // larger entries are streamed (to the store while hashing) rather than held in memory
+
+        static const qint64 BufferLimit = NEntryReader::BufferLimit;
+
+        // a wave is read while the previous one is decoded and written
+
+        static const qint64 WaveBytes = 32 << 20;
+        static const int WaveEntries = 256;
+        static const int MaxReadThreads = 32;
+
+        // how long we keep adjusting thread counts
+
+        static const qint64 TuneMs = 5000;
+
+    signals:
+        void progress(qint64 bytes);
+
+    private:
+        struct ReadRound {
+            QVector<QByteArray> stored;
+            double rate; // bytes per second
+        };
+
+        // extract one entry the sequential way, including retries
+
+        void extractWithRetries(qint64 index);
+
+        // returns the entries that failed, to be retried by extractWithRetries
+
+        QVector<qint64> runParallel(const QVector<qint64>& entries);
+
+        ReadRound readWave(const QVector<qint64>& wave, QThreadPool* pool, int threads);
+        double writeWave(const QVector<qint64>& wave, const QVector<QByteArray>& stored,
+                         QThreadPool* pool, int threads, QVector<char>& succeeded);
+
+        // settings key for the device a path is on
+
+        static QString deviceKey(const QString& path);
+
+        // false with a reason if the entry failed, transient tells whether to try again
+
+        bool extractEntry(qint64 index, const QString& target, QString& reason, bool& transient);
+        bool writeEntry(qint64 index, const QString& target, QString& reason, bool& transient);
+        bool storeEntry(qint64 index, const QString& target, QString& reason, bool& transient);
+
+        // the whole entry, or just the requested range
+
+        bool readEntry(qint64 index, QIODevice* device);
+
+        // for data that is already in memory
+
+        bool writeData(const QString& target, const QByteArray& data, QString& reason, bool& transient);
+        bool storeData(const QString& target, const QByteArray& data, QString& reason, bool& transient);
+
+        bool makeDirectory(const QString& target, QString& reason, bool& transient);
+
+        // the entry failed, figure out whose fault it was
+
+        static void readFailure(const QFileDevice& file, int error, QString& reason, bool& transient);
+
+        // errno (GetLastError() on Windows), right after the call that failed
+
+        static int systemError();
+
+        // whether a system error is worth another attempt
+
+        static bool isTransient(int error);
+
+        NEntryReader* reader;
+        NBlobStore* store = nullptr;
+
+        bool ranged = false;
+        qint64 rangeOffset = 0;
+        qint64 rangeLength = -1;
+        QDir outdir;
+        QDateTime modified; // the archive's
+        QVector<qint64> indices;
+        QVector<Failure> failed;
+        QSet<QString> createdDirs;
+        QMutex dirMutex;
+        NTraceJob trace;
+
+        // updated from the worker threads
+
+        std::atomic<qint64> written { 0 };
+        std::atomic<qint64> deduplicated { 0 };
+};
+
+#endif // NEXTRACTOR_H
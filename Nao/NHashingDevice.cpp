@@ -0,0 +1,30 @@
+#include "NHashingDevice.h"
+
+NHashingDevice::NHashingDevice(QIODevice* target, QCryptographicHash::Algorithm algorithm)
+    : QIODevice(),
+    target(target),
+    hash(algorithm) {
+
+    open(QIODevice::WriteOnly);
+}
+
+qint64 NHashingDevice::readData(char* data, qint64 maxSize) {
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+
+    return -1;
+}
+
+qint64 NHashingDevice::writeData(const char* data, qint64 len) {
+    qint64 written = len;
+
+    // only hash what actually made it to the target
+
+    if (target && (written = target->write(data, len)) < 0)
+        return -1;
+
+    hash.addData(data, static_cast<int>(written));
+    hashed += written;
+
+    return written;
+}
@@ -0,0 +1,28 @@
+#ifndef NHASHINGDEVICE_H
+#define NHASHINGDEVICE_H
+
+#include <QIODevice>
+#include <QCryptographicHash>
+
+// write-only device that hashes everything written to it, and optionally
+// passes it on to another device so data only has to be produced once
+
+class NHashingDevice : public QIODevice {
+    public:
+        explicit NHashingDevice(QIODevice* target = nullptr,
+                                QCryptographicHash::Algorithm algorithm = QCryptographicHash::Sha256);
+
+        QByteArray result() const { return hash.result(); }
+        qint64 bytesHashed() const { return hashed; }
+
+    protected:
+        qint64 readData(char* data, qint64 maxSize) override;
+        qint64 writeData(const char* data, qint64 len) override;
+
+    private:
+        QIODevice* target;
+        QCryptographicHash hash;
+        qint64 hashed = 0;
+};
+
+#endif // NHASHINGDEVICE_H
@@ -1,6 +1,54 @@
 #include "NMain.h"
 
 #include <QProgressDialog>
+#include <QApplication>
+
+#include <limits>
+
+namespace {
+
+    // passes everything on to another device, reporting progress through bytesWritten()
+    // in steps of at least ProgressStep bytes so a worker thread doesn't flood the GUI.
+    // whatever is left over is reported on close()
+
+    class NProgressDevice : public QIODevice {
+        public:
+            explicit NProgressDevice(QIODevice* target) : target(target) {
+                open(QIODevice::WriteOnly);
+            }
+
+            static const qint64 ProgressStep = 1 << 20;
+
+            void close() override {
+                if (pending > 0) {
+                    emit bytesWritten(pending);
+                    pending = 0;
+                }
+
+                QIODevice::close();
+            }
+
+        protected:
+            qint64 readData(char*, qint64) override {
+                return -1;
+            }
+
+            qint64 writeData(const char* data, qint64 len) override {
+                qint64 written = target->write(data, len);
+
+                if (written > 0 && (pending += written) >= ProgressStep) {
+                    emit bytesWritten(pending);
+                    pending = 0;
+                }
+
+                return written;
+            }
+
+        private:
+            QIODevice* target;
+            qint64 pending = 0;
+    };
+}
 
 NMain::NMain()
     : QMainWindow(),
@@ -45,6 +93,18 @@ void NMain::openFile() {
 }
 
 void NMain::loadFile(QString file) {
+    NAO_TRACE("load");
+
+    // drop the preview and the server before the readers they use go away
+
+    preview->setSource(nullptr);
+
+    delete server;
+    server = nullptr;
+    serve_action->setChecked(false);
+
+    delete entryReader;
+    entryReader = nullptr;
 
     // delete our readers
 
@@ -68,6 +128,10 @@ void NMain::loadFile(QString file) {
 
         extract_button->setDisabled(true);
         extract_all_button->setDisabled(true);
+        repack_action->setDisabled(true);
+        serve_action->setDisabled(true);
+        manifest_action->setDisabled(true);
+        retry_action->setDisabled(true);
 
         // disconnect slots
 
@@ -92,6 +156,16 @@ void NMain::loadFile(QString file) {
         switch (currentType = LibNao::Utils::getFileType(file)) {
             case LibNao::CRIWare:
                 CRIWareHandler(file);
+
+                entryReader = new NEntryReader(currentType, file, CRIWareReader, nullptr);
+                preview->setSource(entryReader);
+
+                // usm streams are demuxed, there's nothing to put back
+
+                repack_action->setEnabled(CRIWareReader->isPak());
+                serve_action->setEnabled(true);
+                manifest_action->setEnabled(true);
+                retry_action->setEnabled(true);
                 break;
 
             case LibNao::WWise:
@@ -104,6 +178,14 @@ void NMain::loadFile(QString file) {
 
             case LibNao::PG_DAT:
                 PG_DATHandler(file);
+
+                entryReader = new NEntryReader(currentType, file, nullptr, PG_DATReader);
+                preview->setSource(entryReader);
+
+                repack_action->setEnabled(true);
+                serve_action->setEnabled(true);
+                manifest_action->setEnabled(true);
+                retry_action->setEnabled(true);
                 break;
 
             case LibNao::None:
@@ -122,7 +204,15 @@ void NMain::loadFile(QString file) {
 }
 
 void NMain::PG_DATHandler(QString file) {
-    PG_DATReader = new NaoDATReader(file);
+
+    // the reader parses the whole header up front
+
+    {
+        NAO_TRACE("parse");
+        PG_DATReader = new NaoDATReader(file);
+    }
+
+    NAO_TRACE("table");
     const QVector<NaoDATReader::EmbeddedFile>& files = PG_DATReader->getFiles();
 
     // setup our table
@@ -176,7 +266,15 @@ void NMain::PG_DATHandler(QString file) {
 }
 
 void NMain::CRIWareHandler(QString file) {
-    CRIWareReader = new NaoCRIWareReader(file);
+
+    // the reader parses the header and TOC up front
+
+    {
+        NAO_TRACE("parse");
+        CRIWareReader = new NaoCRIWareReader(file);
+    }
+
+    NAO_TRACE("table");
     const QVector<NaoCRIWareReader::EmbeddedFile>& files = CRIWareReader->getFiles();
 
     // setup our table
@@ -361,11 +459,13 @@ void NMain::extractSingleFile() {
                             QMessageBox::Ok,
                             QMessageBox::Ok);
             } else {
+                qint64 index = file->data(FileIndexRole).toLongLong();
+
                 QProgressDialog* dialog = new QProgressDialog(
                             "Extracting files...",
                             "",
                             0,
-                            0,
+                            static_cast<int>(entryReader->entrySize(index) >> 10),
                             this);
                 dialog->setCancelButton(nullptr);
                 dialog->setModal(true);
@@ -373,35 +473,23 @@ void NMain::extractSingleFile() {
                 dialog->setWindowFlags(dialog->windowFlags() & ~Qt::WindowCloseButtonHint & ~Qt::WindowContextHelpButtonHint);
                 dialog->show();
 
-                // handle different types appropiately
-
-                switch (currentType) {
-                    case LibNao::CRIWare:
-                        connect(CRIWareReader, &NaoCRIWareReader::extractProgress, this, [=](const qint64 current, const qint64 max) {
-                            if (dialog->maximum() != (max >> 10)) {
-                                dialog->setMaximum(max >> 10);
-                            }
+                // the readers' own progress signals also fire for preview and server reads,
+                // so we count what actually reaches the file instead
 
-                            dialog->setValue(current >> 10);
-                        });
-                        break;
+                NProgressDevice* progress = new NProgressDevice(outfile);
 
-                    case LibNao::PG_DAT:
-                        connect(PG_DATReader, &NaoDATReader::setExtractMaximum, this, [dialog](const qint64 max) {
-                            dialog->setMaximum(max);
-                        });
-
-                        connect(PG_DATReader, &NaoDATReader::extractProgress, this,  [dialog](const qint64 current) {
-                            dialog->setValue(current);
-                        });
-                }
+                connect(progress, &QIODevice::bytesWritten, this, [dialog](const qint64 bytes) {
+                    NAO_TRACE("progress");
 
+                    dialog->setValue(dialog->value() + static_cast<int>(bytes >> 10));
+                });
 
                 QFutureWatcher<bool>* watcher = new QFutureWatcher<bool>();
 
                 // cleanup function
 
                 connect(watcher, &QFutureWatcher<bool>::finished, this, [=]() {
+                    progress->close();
                     outfile->close();
 
                     // show success our failure
@@ -422,56 +510,116 @@ void NMain::extractSingleFile() {
                                     QMessageBox::Ok);
                     }
 
-                    // disconnect slots
-
-                    switch (currentType) {
-                        case LibNao::CRIWare:
-                            disconnect(CRIWareReader, &NaoCRIWareReader::extractProgress, this, 0);
-                            break;
-
-                        case LibNao::PG_DAT:
-                            disconnect(PG_DATReader, &NaoDATReader::setExtractMaximum, this, 0);
-                            disconnect(PG_DATReader, &NaoDATReader::extractProgress, this, 0);
-                            break;
-                    }
+                    if (NTrace::enabled())
+                        NTrace::writeChromeTrace();
 
                     // delete members
 
                     watcher->deleteLater();
                     dialog->deleteLater();
+                    progress->deleteLater();
                     outfile->deleteLater();
                 });
 
-                // we run the extraction in a thread (otherwise the dialog would show nothing)
-
-                QFuture<bool> future;
+                // we run the extraction in a thread (otherwise the dialog would show nothing).
+                // it goes through the entry reader, which serializes access to the archive
+                // readers with the preview and the server
 
-                switch (currentType) {
-                    case LibNao::CRIWare:
-                        future = QtConcurrent::run(
-                                    CRIWareReader,
-                                    &NaoCRIWareReader::extractFileTo,
-                                    file->data(FileIndexRole).toLongLong(),
-                                    outfile
-                                );
+                NEntryReader* reader = entryReader;
 
-                        break;
+                watcher->setFuture(QtConcurrent::run([=]() {
+                    NAO_TRACE("extract");
 
-                    case LibNao::PG_DAT:
-                        future = QtConcurrent::run(
-                                    PG_DATReader,
-                                    &NaoDATReader::extractFileTo,
-                                    file->data(FileIndexRole).toLongLong(),
-                                    outfile
-                                );
-                }
-
-                watcher->setFuture(future);
+                    return reader->readTo(index, progress);
+                }));
             }
         }
     }
 }
 
+void NMain::extractFirstBytes() {
+    QTableWidgetItem* file = table->item(table->selectionModel()->selectedRows().at(0).row(), 0);
+    qint64 index = file->data(FileIndexRole).toLongLong();
+
+    bool ok;
+    int bytes = QInputDialog::getInt(
+                this,
+                "Extract first bytes",
+                "Number of bytes to extract:",
+                firstBytes,
+                1,
+                std::numeric_limits<int>::max(),
+                1,
+                &ok);
+
+    if (!ok)
+        return;
+
+    firstBytes = bytes;
+
+    QString output = QFileDialog::getSaveFileName(
+                this,
+                "Select output file",
+                savePath + "/" + QFileInfo(entryReader->path(index)).fileName());
+
+    if (output.isEmpty())
+        return;
+
+    savePath = QFileInfo(output).absolutePath();
+
+    // past the first 0x100 bytes of a compressed entry this decodes nearly all of it,
+    // so it runs in a thread behind a dialog like a whole file would. there's no progress
+    // to report until the range is decoded, so the dialog just shows that it's busy.
+
+    QProgressDialog* dialog = new QProgressDialog(
+                "Extracting first bytes...",
+                "",
+                0,
+                0,
+                this);
+    dialog->setCancelButton(nullptr);
+    dialog->setModal(true);
+    dialog->setFixedWidth(this->width() / 2);
+    dialog->setWindowFlags(dialog->windowFlags() & ~Qt::WindowCloseButtonHint & ~Qt::WindowContextHelpButtonHint);
+    dialog->show();
+
+    QFutureWatcher<bool>* watcher = new QFutureWatcher<bool>();
+
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [=]() {
+        if (!watcher->result()) {
+            QMessageBox::critical(
+                        this,
+                        "File save error",
+                        "Could not save the following file:\n\n" + output,
+                        QMessageBox::Ok,
+                        QMessageBox::Ok);
+        }
+
+        if (NTrace::enabled())
+            NTrace::writeChromeTrace();
+
+        watcher->deleteLater();
+        dialog->deleteLater();
+    });
+
+    NEntryReader* reader = entryReader;
+
+    watcher->setFuture(QtConcurrent::run([=]() {
+        NAO_TRACE("extract");
+
+        QByteArray data = reader->read(index, bytes);
+
+        // nothing read is only a failure if there was something to read
+
+        if (data.isEmpty() && reader->entrySize(index) != 0)
+            return false;
+
+        QFile outfile(output);
+
+        return outfile.open(QIODevice::WriteOnly) && outfile.write(data) == data.size();
+    }));
+}
+
 void NMain::extractAll() {
     QString output = QFileDialog::getExistingDirectory(
                 this,
@@ -484,199 +632,488 @@ void NMain::extractAll() {
 
         savePath = output;
 
-        QString originFileName;
+        // the archive name can be a path, get the actual name from it like this
 
-        // get the original file name (to make the target folder)
+        QString outdir = output + "/" + QFileInfo(entryReader->archive()).fileName();
 
-        switch (currentType) {
-            case LibNao::CRIWare: {
-                originFileName = CRIWareReader->getFileName();
+        QVector<qint64> indices;
 
-                break;
-            }
+        for (qint64 i = 0; i < entryReader->count(); ++i)
+            indices.append(i);
 
-            case LibNao::PG_DAT: {
-                originFileName = PG_DATReader->getFileName();
+        runExtraction(outdir, indices);
+    }
+}
 
-                break;
-            }
+void NMain::runExtraction(const QString& outdir, const QVector<qint64>& indices) {
+
+    // save some values for display
+
+    qint64 totalEmbeddedSize = 0;
+    qint64 totalExtractedSize = 0;
+    qint64 fileCount = indices.size();
+
+    for (qint64 i : indices) {
+        totalEmbeddedSize += entryReader->info(i).size;
+        totalExtractedSize += entryReader->entrySize(i);
+    }
+
+    // QProgressDialog does not play well with values over 2^32,
+    // so we divide by 1024 if the value is over 2^31 (files larger than 4 TiB are rather unlikely)
+
+    QProgressDialog* dialog = new QProgressDialog(
+                "Extracting files...",
+                "",
+                0,
+                (totalExtractedSize > 0x8FFFFFFFULL) ?
+                    (totalExtractedSize >> 10) : totalExtractedSize,
+                this);
+
+    dialog->setCancelButton(nullptr);
+    dialog->setModal(true);
+    dialog->setFixedWidth(this->width() / 2);
+    dialog->setWindowFlags(dialog->windowFlags() & ~Qt::WindowCloseButtonHint & ~Qt::WindowContextHelpButtonHint);
+    dialog->show();
+
+    NExtractor* extractor = new NExtractor(entryReader, outdir, indices);
+
+    // the store lives next to the per-archive directories, so dumping
+    // several archives into the same directory shares it between all of them
+
+    NBlobStore* store = nullptr;
+
+    if (dedup_action->isChecked()) {
+        store = new NBlobStore(QFileInfo(outdir).absolutePath() + "/.nao-store");
+
+        if (!store->isValid()) {
+            QMessageBox::critical(
+                        this,
+                        "Store error",
+                        "Could not create the deduplication store in:\n\n" + store->root(),
+                        QMessageBox::Ok,
+                        QMessageBox::Ok);
+
+            delete store;
+            delete extractor;
+            delete dialog;
+
+            return;
         }
 
-        QDir outdir(output + "/" + QFileInfo(originFileName).fileName()); // originFileName can be a path, get the actual name from it like this
+        extractor->setStore(store);
+    }
 
-        // save some values for display
+    connect(extractor, &NExtractor::progress, this, [=](qint64 v) {
+        NAO_TRACE("progress");
 
-        qint64 totalEmbeddedSize = 0;
-        qint64 totalExtractedSize = 0;
-        qint64 fileCount = 0;
+        // adjust value to earlier mentioned limits
 
-        switch (currentType) {
-            case LibNao::CRIWare: {
-                QSet<QString> dirs;
-                const QVector<NaoCRIWareReader::EmbeddedFile>& files = CRIWareReader->getFiles();
-                fileCount = files.length();
+        dialog->setValue(dialog->value() + ((totalExtractedSize > 0x8FFFFFFFULL) ? (v >> 10) : v));
+    });
 
-                // make a set (unique items) of all directories, and also calculate the total file size before and after extraction
+    QFutureWatcher<void>* watcher = new QFutureWatcher<void>();
 
-                for (int i = 0; i < fileCount; i++) {
-                    totalEmbeddedSize += files.at(i).size;
-                    totalExtractedSize += files.at(i).extractedSize;
+    // display some information and perform cleanup when finished
 
-                    if (CRIWareReader->isPak()) {
-                        if (!files.at(i).path.isEmpty())
-                            dirs.insert(files.at(i).path);
-                    }
-                }
+    connect(watcher, &QFutureWatcher<void>::finished, this, [=]() {
+        QString breakdown;
 
-                // create all direcories if cpk, else just create a directory for output
+        if (NTrace::enabled()) {
+            NTrace::writeChromeTrace();
 
-                if (CRIWareReader->isPak()) {
-                    QSet<QString>::const_iterator it = dirs.constBegin();
+            breakdown = "\n\n" + extractor->traceSummary();
+        }
+
+        QString summary = "Files:\t" + QString::number(fileCount) + "\n"
+                "Read:\t" + LibNao::Utils::getShortSize(totalEmbeddedSize) + "\n"
+                "Wrote:\t" + LibNao::Utils::getShortSize(extractor->bytesWritten()) +
+                (store ? "\nLinked:\t" + LibNao::Utils::getShortSize(extractor->bytesDeduplicated()) : QString()) +
+                breakdown;
 
-                    while (it != dirs.constEnd()) {
-                        if (!outdir.mkpath(*it))
-                            qFatal((QString("Could not create directory ") + outdir.path() + "/" + *it).toLatin1().data());
+        QVector<qint64> retry;
 
-                        ++it;
+        if (extractor->failures().isEmpty()) {
+            QMessageBox::information(
+                        this,
+                        "Done",
+                        "Extraction complete.\n\n" + summary,
+                        QMessageBox::Ok,
+                        QMessageBox::Ok);
+        } else {
+
+            // everything that could be extracted was, offer to retry just the rest
+
+            QMessageBox box(this);
+            box.setIcon(QMessageBox::Warning);
+            box.setWindowTitle("Extraction incomplete");
+            box.setText(QString("%0 of %1 files could not be extracted.\n\n")
+                        .arg(extractor->failures().size())
+                        .arg(fileCount) + summary);
+            box.setDetailedText(extractor->report());
+
+            QPushButton* retryButton = box.addButton("Retry failed", QMessageBox::AcceptRole);
+            QPushButton* saveButton = box.addButton("Save report...", QMessageBox::ActionRole);
+            box.addButton(QMessageBox::Close);
+
+            // saving the report shouldn't close the box. the JSON list can be
+            // loaded again through "Retry failures from list..."
+
+            const QString listFilter = "Failure list (*.json)";
+            const QString textFilter = "Text report (*.txt)";
+
+            do {
+                box.exec();
+
+                if (box.clickedButton() == saveButton) {
+                    QString filter;
+                    QString reportFile = QFileDialog::getSaveFileName(
+                                this,
+                                "Save error report",
+                                savePath + "/failures.json",
+                                listFilter + ";;" + textFilter,
+                                &filter);
+
+                    bool text = (filter == textFilter || reportFile.endsWith(".txt"));
+                    QByteArray contents = text ? extractor->report().toUtf8() : extractor->failureList();
+
+                    QFile file(reportFile);
+
+                    if (!reportFile.isEmpty() && (!file.open(QIODevice::WriteOnly | QIODevice::Text) ||
+                                                  file.write(contents) != contents.size())) {
+                        QMessageBox::critical(
+                                    this,
+                                    "File save error",
+                                    "Could not save the following file:\n\n" + reportFile,
+                                    QMessageBox::Ok,
+                                    QMessageBox::Ok);
                     }
-                } else {
-                    outdir.mkdir(".");
                 }
+            } while (box.clickedButton() == saveButton);
 
-                break;
-            }
+            if (box.clickedButton() == retryButton)
+                retry = extractor->failedIndices();
+        }
 
-            case LibNao::PG_DAT: {
+        watcher->deleteLater();
+        dialog->deleteLater();
+        extractor->deleteLater();
+        delete store;
 
-                // create the output directory
+        if (!retry.isEmpty())
+            runExtraction(outdir, retry);
+    });
 
-                outdir.mkdir(".");
+    // run our extraction in a thread
 
-                const QVector<NaoDATReader::EmbeddedFile>& files = PG_DATReader->getFiles();
-                fileCount = files.size();
+    watcher->setFuture(QtConcurrent::run(extractor, &NExtractor::run));
+}
 
-                // calculate total file size
+void NMain::retryFailureList() {
+    QString listFile = QFileDialog::getOpenFileName(
+                this,
+                "Select failure list",
+                savePath,
+                "Failure list (*.json)");
+
+    if (listFile.isEmpty())
+        return;
+
+    QFile file(listFile);
+    QString archive;
+    QString output;
+    QString error;
+    QVector<NExtractor::Failure> failures;
+
+    if (!file.open(QIODevice::ReadOnly))
+        error = file.errorString();
+    else
+        NExtractor::readFailureList(file.readAll(), archive, output, failures, error);
+
+    if (!error.isEmpty()) {
+        QMessageBox::critical(
+                    this,
+                    "File open error",
+                    "Could not read the failure list:\n\n" + listFile + "\n\n" + error,
+                    QMessageBox::Ok,
+                    QMessageBox::Ok);
+        return;
+    }
 
-                for (qint64 i = 0; i < fileCount; ++i) {
-                    totalEmbeddedSize += files.at(i).size;
-                    totalExtractedSize += files.at(i).size;
-                }
+    if (QFileInfo(archive) != QFileInfo(entryReader->archive())) {
+        QMessageBox::warning(
+                    this,
+                    "Wrong archive",
+                    "The failure list belongs to another archive, open it first:\n\n" + archive,
+                    QMessageBox::Ok,
+                    QMessageBox::Ok);
+        return;
+    }
 
-                break;
-            }
+    // the index is only trusted if it still names the same path, the archive may have
+    // been rebuilt since. otherwise look the path up
+
+    QHash<QString, qint64> byPath;
+    QVector<qint64> indices;
+    QStringList missing;
+
+    for (const NExtractor::Failure& f : failures) {
+        if (f.index >= 0 && f.index < entryReader->count() && entryReader->path(f.index) == f.path) {
+            indices.append(f.index);
+            continue;
         }
 
-        // QProgressDialog does not play well with values over 2^32,
-        // so we divide by 1024 if the value is over 2^31 (files larger than 4 TiB are rather unlikely)
+        if (byPath.isEmpty()) {
+            for (qint64 i = 0; i < entryReader->count(); ++i)
+                byPath.insert(entryReader->path(i), i);
+        }
+
+        if (byPath.contains(f.path))
+            indices.append(byPath.value(f.path));
+        else
+            missing.append(f.path);
+    }
+
+    if (!missing.isEmpty()) {
+        QMessageBox box(this);
+        box.setIcon(QMessageBox::Warning);
+        box.setWindowTitle("Entries not found");
+        box.setText(QString("%0 of %1 entries are no longer in the archive and will be skipped.")
+                    .arg(missing.size())
+                    .arg(failures.size()));
+        box.setDetailedText(missing.join("\n"));
+        box.addButton(QMessageBox::Ok);
+        box.exec();
+    }
+
+    if (indices.isEmpty())
+        return;
+
+    savePath = QFileInfo(listFile).absolutePath();
+
+    runExtraction(output, indices);
+}
+
+void NMain::repackArchive() {
+    QString archive = (currentType == LibNao::CRIWare) ? CRIWareReader->getFileName() : PG_DATReader->getFileName();
+    QString archiveName = QFileInfo(archive).fileName();
+
+    // same layout extractAll produces, so an extracted folder can be edited in place
+
+    QString input = QFileDialog::getExistingDirectory(
+                this,
+                "Select folder with modified files",
+                savePath + "/" + archiveName);
+
+    if (input.isEmpty())
+        return;
+
+    QString output = QFileDialog::getSaveFileName(
+                this,
+                "Select output file",
+                savePath + "/" + archiveName);
+
+    if (output.isEmpty())
+        return;
 
-        QProgressDialog* dialog = new QProgressDialog(
-                    "Extracting files...",
-                    "",
-                    0,
-                    (totalExtractedSize > 0x8FFFFFFFULL) ?
-                        (totalExtractedSize >> 10) : totalExtractedSize,
-                    this);
+    savePath = QFileInfo(output).absolutePath();
 
-        dialog->setCancelButton(nullptr);
-        dialog->setModal(true);
-        dialog->setFixedWidth(this->width() / 2);
-        dialog->setWindowFlags(dialog->windowFlags() & ~Qt::WindowCloseButtonHint & ~Qt::WindowContextHelpButtonHint);
-        dialog->show();
+    NArchiveWriter* writer;
 
-        connect(this, &NMain::extractAllDialogProgress, this, [=](qint64 v) {
+    if (currentType == LibNao::CRIWare)
+        writer = new NCPKWriter(archive);
+    else
+        writer = new NDATWriter(archive);
 
-            // adjust value to earlier mentioned limits
+    // every file in the folder is a candidate, the ones that still match their entry are
+    // left alone so an unmodified archive comes out identical (and without recompressing)
 
-            dialog->setValue(dialog->value() + ((totalExtractedSize > 0x8FFFFFFFULL) ? (v >> 10) : v));
-        });
+    struct Candidate {
+        qint64 index;
+        QString entry;
+        QString file;
+    };
 
-        QFutureWatcher<void>* watcher = new QFutureWatcher<void>();
+    QVector<Candidate> candidates;
 
-        // display some information and perform cleanup when finished
+    for (int i = 0; i < table->rowCount(); ++i) {
+        QTableWidgetItem* item = table->item(i, 0);
+        QString path = item->data(FilePathRole).toString();
+        QString name = item->data(FileNameRole).toString();
+        QString entry = (path.isEmpty() ? "" : path + "/") + name;
 
-        connect(watcher, &QFutureWatcher<void>::finished, this, [=]() {
+        QFileInfo candidate(input + "/" + (path.isEmpty() ? "" : path + "/") + LibNao::Utils::sanitizeFileName(name));
 
+        if (candidate.isFile())
+            candidates.append({ item->data(FileIndexRole).toLongLong(), entry, candidate.absoluteFilePath() });
+    }
+
+    QProgressDialog* dialog = new QProgressDialog(
+                "Repacking archive...",
+                "",
+                0,
+                0,
+                this);
+    dialog->setCancelButton(nullptr);
+    dialog->setModal(true);
+    dialog->setFixedWidth(this->width() / 2);
+    dialog->setWindowFlags(dialog->windowFlags() & ~Qt::WindowCloseButtonHint & ~Qt::WindowContextHelpButtonHint);
+    dialog->show();
+
+    connect(writer, &NArchiveWriter::writeProgress, this, [dialog](const qint64 current, const qint64 max) {
+        if (dialog->maximum() != (max >> 10)) {
+            dialog->setMaximum(max >> 10);
+        }
+
+        dialog->setValue(current >> 10);
+    });
+
+    QFutureWatcher<bool>* watcher = new QFutureWatcher<bool>();
+
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [=]() {
+        if (watcher->result()) {
             QMessageBox::information(
                         this,
                         "Done",
-                        QString("Extraction complete.\n\n") +
-                                "Files:\t" + QString::number(fileCount) + "\n"
-                                "Read:\t" + LibNao::Utils::getShortSize(totalEmbeddedSize) + "\n"
-                                "Wrote:\t" + LibNao::Utils::getShortSize(totalExtractedSize),
+                        QString("Repacking complete.\n\n") +
+                                "Replaced:\t" + QString::number(writer->replacementCount()) + "\n"
+                                "Wrote:\t" + LibNao::Utils::getShortSize(QFileInfo(output).size()),
+                        QMessageBox::Ok,
+                        QMessageBox::Ok);
+        } else {
+            QMessageBox::critical(
+                        this,
+                        "Repack error",
+                        "Could not repack the archive:\n\n" + writer->errorString(),
                         QMessageBox::Ok,
                         QMessageBox::Ok);
+        }
 
-            disconnect(this, &NMain::extractAllDialogProgress, this, 0);
+        watcher->deleteLater();
+        dialog->deleteLater();
+        writer->deleteLater();
+    });
 
-            watcher->deleteLater();
-            dialog->deleteLater();
-        });
+    // comparing can mean reading entries, so that happens on the worker thread as well
 
-        // run our extraction in a thread
+    NEntryReader* reader = entryReader;
+    QDateTime modified = QFileInfo(archive).lastModified();
 
-        QFuture<void> future = QtConcurrent::run([=]() {
-            for (int i = 0; i < fileCount; ++i) {
-                switch (currentType) {
-                    case LibNao::CRIWare: {
-                        NaoCRIWareReader::EmbeddedFile file = CRIWareReader->getFiles().at(i);
+    watcher->setFuture(QtConcurrent::run([=]() {
+        {
+            NAO_TRACE("compare");
 
-                        // construct output file path
+            for (const Candidate& c : candidates) {
+                QFileInfo info(c.file);
 
-                        QString target;
-                        if (CRIWareReader->isPak()) {
-                            target = outdir.absolutePath() + "/" + file.path + "/" +
-                                    LibNao::Utils::sanitizeFileName(file.name);
-                        } else {
-                            target = outdir.absolutePath() +
-                                    "/" + LibNao::Utils::sanitizeFileName(QFileInfo(file.name).baseName()) +
-                                    ((file.type == NaoCRIWareReader::EmbeddedFile::Video) ? ".mpeg" : ".adx");
-                        }
+                // a new size says enough, and a file that still has the archive's time is
+                // one the extractor wrote and nobody touched since. only the rest is read
 
-                        QFile outfile(target);
+                if (info.size() != reader->entrySize(c.index))
+                    writer->replaceFile(c.entry, c.file);
+                else if (info.lastModified().toSecsSinceEpoch() != modified.toSecsSinceEpoch() &&
+                         !reader->sameContents(c.index, c.file))
+                    writer->replaceFile(c.entry, c.file);
+            }
+        }
 
-                        if (!outfile.open(QIODevice::WriteOnly))
-                            qFatal(QString("Could not open file %0 for writing").arg(target).toLatin1().data());
+        return writer->write(output);
+    }));
+}
 
-                        // extract into memory (as of now)
+void NMain::toggleServer(bool enable) {
+    delete server;
+    server = nullptr;
 
-                        outfile.write(CRIWareReader->extractFileAt(i));
-                        outfile.close();
+    if (!enable || !entryReader)
+        return;
 
-                        emit extractAllDialogProgress(file.extractedSize);
+    server = new NArchiveServer(entryReader, this);
 
-                        break;
-                    }
+    if (!server->start()) {
+        QMessageBox::critical(
+                    this,
+                    "Server error",
+                    "Could not start the server:\n\n" + server->errorString(),
+                    QMessageBox::Ok,
+                    QMessageBox::Ok);
 
-                    case LibNao::PG_DAT: {
-                        NaoDATReader::EmbeddedFile file = PG_DATReader->getFiles().at(i);
+        delete server;
+        server = nullptr;
+        serve_action->setChecked(false);
+    } else {
+        QMessageBox::information(
+                    this,
+                    "Serving archive",
+                    "The entries of this archive can now be read at\n\n" + server->url().toString() +
+                    "<path>\n\nwith range requests, or listed at the root.",
+                    QMessageBox::Ok,
+                    QMessageBox::Ok);
+    }
+}
 
-                        // construct output file path
+void NMain::exportManifest() {
+    const QString jsonFilter = "JSON Lines (*.jsonl)";
+    const QString binaryFilter = "Binary manifest (*.naom)";
 
-                        QFile* outfile = new QFile(outdir.absolutePath() + "/" + file.name);
+    QString filter;
+    QString output = QFileDialog::getSaveFileName(
+                this,
+                "Select manifest file",
+                savePath + "/" + QFileInfo(entryReader->archive()).fileName() + ".jsonl",
+                jsonFilter + ";;" + binaryFilter,
+                &filter);
 
-                        if (!outfile->open(QIODevice::WriteOnly)) {
-                            qFatal(QString("Could not open file %0 for writing").arg(outfile->fileName()).toLatin1().data());
-                        }
+    if (output.isEmpty())
+        return;
 
-                        // extract directly to the file device
+    savePath = QFileInfo(output).absolutePath();
 
-                        PG_DATReader->extractFileTo(i, outfile);
+    NManifestWriter::Format format = (filter == binaryFilter || output.endsWith(".naom")) ?
+                NManifestWriter::Binary : NManifestWriter::JSONLines;
 
-                        outfile->close();
+    NManifestWriter* writer = new NManifestWriter(entryReader);
 
-                        delete outfile;
+    QProgressDialog* dialog = new QProgressDialog(
+                "Hashing entries...",
+                "",
+                0,
+                static_cast<int>(entryReader->count()),
+                this);
+    dialog->setCancelButton(nullptr);
+    dialog->setModal(true);
+    dialog->setFixedWidth(this->width() / 2);
+    dialog->setWindowFlags(dialog->windowFlags() & ~Qt::WindowCloseButtonHint & ~Qt::WindowContextHelpButtonHint);
+    dialog->show();
 
-                        emit extractAllDialogProgress(file.size);
+    connect(writer, &NManifestWriter::exportProgress, this, [dialog](const qint64 current) {
+        dialog->setValue(static_cast<int>(current));
+    });
 
-                        break;
-                    }
-                }
+    QFutureWatcher<bool>* watcher = new QFutureWatcher<bool>();
 
-            }
-        });
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [=]() {
+        if (watcher->result()) {
+            QMessageBox::information(
+                        this,
+                        "Done",
+                        "Manifest written to\n\n" + output,
+                        QMessageBox::Ok,
+                        QMessageBox::Ok);
+        } else {
+            QMessageBox::critical(
+                        this,
+                        "Manifest error",
+                        "Could not export the manifest:\n\n" + writer->errorString(),
+                        QMessageBox::Ok,
+                        QMessageBox::Ok);
+        }
 
-        watcher->setFuture(future);
-    }
+        watcher->deleteLater();
+        dialog->deleteLater();
+        writer->deleteLater();
+    });
+
+    watcher->setFuture(QtConcurrent::run(writer, &NManifestWriter::write, output, format));
 }
 
 void NMain::firstTableSelection() {
@@ -688,6 +1125,20 @@ void NMain::firstTableSelection() {
     disconnect(table->selectionModel(), &QItemSelectionModel::selectionChanged, this, &NMain::firstTableSelection);
 }
 
+void NMain::previewSelection(const QModelIndex& current) {
+    if (!current.isValid() || !entryReader) {
+        preview->clear();
+        return;
+    }
+
+    QTableWidgetItem* file = table->item(current.row(), 0);
+
+    // the table may be half-filled while a file is loading
+
+    if (file)
+        preview->showEntry(file->data(FileIndexRole).toLongLong(), file->data(FileNameRole).toString());
+}
+
 void NMain::setup_window() {
 
     // double hiding is double stealthy (and double as confusing)
@@ -703,7 +1154,9 @@ void NMain::setup_window() {
     QHBoxLayout* buttons_layout = new QHBoxLayout();
     extract_button = new QPushButton("Extract", widget);
     extract_all_button = new QPushButton("Extract all", widget);
-    table = new QTableWidget(widget);
+    QSplitter* splitter = new QSplitter(Qt::Horizontal, widget);
+    table = new QTableWidget(splitter);
+    preview = new NPreview(splitter);
 
     extract_button->setDisabled(true);
     extract_all_button->setDisabled(true);
@@ -719,6 +1172,15 @@ void NMain::setup_window() {
     table->setEditTriggers(QAbstractItemView::NoEditTriggers);
     table->setContextMenuPolicy(Qt::CustomContextMenu);
 
+    // the table's model lives as long as the table, so this only needs connecting once
+
+    connect(table->selectionModel(), &QItemSelectionModel::currentRowChanged, this, &NMain::previewSelection);
+
+    splitter->addWidget(table);
+    splitter->addWidget(preview);
+    splitter->setStretchFactor(0, 3);
+    splitter->setStretchFactor(1, 2);
+
     buttons_layout->addWidget(extract_button, 0, Qt::AlignLeft);
     buttons_layout->addWidget(extract_all_button, 1, Qt::AlignLeft);
 
@@ -726,7 +1188,7 @@ void NMain::setup_window() {
     buttons_layout->setContentsMargins(4, 8, 4, 4);
 
     layout->addLayout(buttons_layout, 0, 0);
-    layout->addWidget(table, 1, 0);
+    layout->addWidget(splitter, 1, 0);
 
     widget->setLayout(layout);
     this->setCentralWidget(widget);
@@ -740,23 +1202,44 @@ void NMain::setup_menus() {
     QMenu* edit_menu = new QMenu("Edit", menu);
     QMenu* about_menu = new QMenu("About", menu);
     QAction* open_file_action = new QAction("Open file");
+    repack_action = new QAction("Repack...");
+    serve_action = new QAction("Serve over HTTP");
+    manifest_action = new QAction("Export manifest...");
+    retry_action = new QAction("Retry failures from list...");
+    dedup_action = new QAction("Deduplicate extracted files");
     QAction* exit_app_action = new QAction("Exit");
     QAction* options_action = new QAction("Options");
     QAction* about_nao_action = new QAction("About Nao");
     QAction* about_qt_action = new QAction("About Qt");
 
     connect(open_file_action, &QAction::triggered, this, &NMain::openFile);
+    connect(repack_action, &QAction::triggered, this, &NMain::repackArchive);
+    connect(serve_action, &QAction::triggered, this, &NMain::toggleServer);
+    connect(manifest_action, &QAction::triggered, this, &NMain::exportManifest);
+    connect(retry_action, &QAction::triggered, this, &NMain::retryFailureList);
     connect(exit_app_action, &QAction::triggered, this, &QMainWindow::close);
     connect(options_action, &QAction::triggered, this, &NMain::openOptions);
     connect(about_nao_action, &QAction::triggered, this, &NMain::about);
     connect(about_qt_action, &QAction::triggered, this, &NMain::aboutQt);
 
     open_file_action->setShortcuts(QKeySequence::Open);
+    repack_action->setDisabled(true);
+    serve_action->setCheckable(true);
+    serve_action->setDisabled(true);
+    manifest_action->setDisabled(true);
+    retry_action->setDisabled(true);
+    dedup_action->setCheckable(true);
     exit_app_action->setShortcuts(QKeySequence::Quit);
 
     file_menu->addAction(open_file_action);
+    file_menu->addAction(repack_action);
+    file_menu->addAction(serve_action);
+    file_menu->addAction(manifest_action);
+    file_menu->addAction(retry_action);
     file_menu->addSeparator();
     file_menu->addAction(exit_app_action);
+    edit_menu->addAction(dedup_action);
+    edit_menu->addSeparator();
     edit_menu->addAction(options_action);
     about_menu->addAction(about_nao_action);
     about_menu->addAction(about_qt_action);
@@ -769,13 +1252,16 @@ void NMain::setup_menus() {
 
     extractContextMenu = new QMenu(this);
     QAction* extractAction = new QAction("Extract");
+    QAction* extractFirstBytesAction = new QAction("Extract first bytes...");
     QAction* extractAllAction = new QAction("Extract all");
 
     extractContextMenu->addAction(extractAction);
+    extractContextMenu->addAction(extractFirstBytesAction);
     extractContextMenu->addSeparator();
     extractContextMenu->addAction(extractAllAction);
 
     connect(extractAction, &QAction::triggered, this, &NMain::extractSingleFile);
+    connect(extractFirstBytesAction, &QAction::triggered, this, &NMain::extractFirstBytes);
     connect(extractAllAction, &QAction::triggered, this, &NMain::extractAll);
 }
 
@@ -17,6 +17,8 @@
 #include <QMessageBox>
 
 #include <QProgressDialog>
+#include <QSplitter>
+#include <QInputDialog>
 
 #include <QDebug>
 
@@ -24,6 +26,15 @@
 #include <NaoCRIWareReader.h>
 #include <NaoDATReader.h>
 
+#include "NEntryReader.h"
+#include "NPreview.h"
+#include "NDATWriter.h"
+#include "NCPKWriter.h"
+#include "NTrace.h"
+#include "NArchiveServer.h"
+#include "NManifestWriter.h"
+#include "NExtractor.h"
+
 class NMain : public QMainWindow {
 		Q_OBJECT
 
@@ -31,9 +42,6 @@ class NMain : public QMainWindow {
         NMain();
         ~NMain() {}
 
-    signals:
-        void extractAllDialogProgress(qint64 v); // signal to self
-
     private slots:
         void openFile();
         void openOptions() {}
@@ -45,11 +53,18 @@ class NMain : public QMainWindow {
         void dropEvent(QDropEvent* e);
 
         void firstTableSelection(); // to enable the single-file extract button
+        void previewSelection(const QModelIndex& current);
 
         void extractSingleFile();
+        void extractFirstBytes();
         void extractAll();
         void extractRightClickEvent(const QPoint& p);
 
+        void repackArchive();
+        void toggleServer(bool enable);
+        void exportManifest();
+        void retryFailureList();
+
     private:
 
         // QTableWidgetItem data roles, starting at Qt::UserRole
@@ -66,17 +81,32 @@ class NMain : public QMainWindow {
         };
 
         QMenu* extractContextMenu       = nullptr;
+        QAction* repack_action          = nullptr;
+        QAction* serve_action           = nullptr;
+        QAction* manifest_action        = nullptr;
+        QAction* retry_action           = nullptr;
+        QAction* dedup_action           = nullptr;
         QPushButton* extract_button     = nullptr;
         QPushButton* extract_all_button = nullptr;
         QTableWidget* table             = nullptr;
+        NPreview* preview               = nullptr;
 
         LibNao::FileType currentType = LibNao::None;
 
         NaoCRIWareReader* CRIWareReader = nullptr;
         NaoDATReader* PG_DATReader = nullptr;
 
+        NEntryReader* entryReader = nullptr;
+        NArchiveServer* server = nullptr;
+
         QString savePath;
 
+        // last amount used for "Extract first bytes"
+
+        int firstBytes = 4096;
+
+        void runExtraction(const QString& outdir, const QVector<qint64>& indices);
+
         void CRIWareHandler(QString file);
         void PG_DATHandler(QString file);
         void setup_window();
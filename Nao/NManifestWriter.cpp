@@ -0,0 +1,127 @@
+#include "NManifestWriter.h"
+#include "NHashingDevice.h"
+#include "NTrace.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDataStream>
+#include <QFile>
+#include <QCryptographicHash>
+
+#include <functional>
+
+// entries per thread in flight before we write a batch out
+
+static const int BatchPerThread = 16;
+
+NManifestWriter::Record NManifestWriter::describe(qint64 index) {
+    Record record = { index, reader->info(index), QByteArray() };
+    const qint64 size = record.info.extractedSize;
+
+    // dat entries are streamed without the reader lock anyway, and cpk entries too large to
+    // hold have to go through the reader and its lock
+
+    if (reader->type() != LibNao::CRIWare || size > NEntryReader::BufferLimit) {
+        NAO_TRACE("hash");
+
+        NHashingDevice hash;
+
+        if (reader->readTo(index, &hash) && hash.bytesHashed() == size)
+            record.hash = hash.result();
+
+        return record;
+    }
+
+    // matched entries are read and decoded without the reader, the rest is decoded under
+    // its lock. hashing happens outside of it either way.
+
+    QByteArray data;
+
+    {
+        NAO_TRACE("decompress");
+        data = reader->hasStoredData(index) ? reader->decodeStored(index, reader->readStored(index)) : reader->read(index);
+    }
+
+    NAO_TRACE("hash");
+
+    if (data.size() == size)
+        record.hash = QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+
+    return record;
+}
+
+bool NManifestWriter::write(const QString& target, Format format) {
+    QFile file(target);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        error = "Could not open " + target + " for writing";
+        return false;
+    }
+
+    const qint64 count = reader->count();
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    if (format == Binary) {
+        stream.writeRawData("NAOM", 4);
+        stream << BinaryVersion << static_cast<quint64>(count);
+    }
+
+    const int batchSize = qMax(1, QThread::idealThreadCount()) * BatchPerThread;
+
+    std::function<Record(const qint64&)> describeEntry = [this](const qint64& index) {
+        return describe(index);
+    };
+
+    for (qint64 start = 0; start < count; start += batchSize) {
+        QVector<qint64> indices;
+
+        for (qint64 i = start; i < qMin(count, start + batchSize); ++i)
+            indices.append(i);
+
+        QVector<Record> records = QtConcurrent::blockingMapped<QVector<Record>>(indices, describeEntry);
+
+        NAO_TRACE("write");
+
+        for (const Record& r : records) {
+            const NEntryReader::Info& info = r.info;
+
+            if (format == JSONLines) {
+                QJsonObject object;
+
+                object["index"] = r.index;
+                object["path"] = info.path;
+                object["offset"] = info.offset;
+                object["extraOffset"] = info.extraOffset;
+                object["size"] = info.size;
+                object["extractedSize"] = info.extractedSize;
+                object["ratio"] = (info.extractedSize > 0) ?
+                            QJsonValue(static_cast<double>(info.size) / info.extractedSize) : QJsonValue();
+                object["type"] = info.type;
+                object["bitrate"] = info.bitrate;
+                object["sha256"] = r.hash.isEmpty() ? QJsonValue() : QJsonValue(QString(r.hash.toHex()));
+
+                file.write(QJsonDocument(object).toJson(QJsonDocument::Compact) + "\n");
+            } else {
+                quint8 type = (info.type == "Video") ? 1 : (info.type == "Audio") ? 2 : 0;
+                QByteArray hash = r.hash.isEmpty() ? QByteArray(32, '\0') : r.hash;
+
+                stream << info.path.toUtf8()
+                       << info.offset << info.extraOffset << info.size << info.extractedSize << info.bitrate
+                       << type << static_cast<quint8>(r.hash.isEmpty() ? 0 : 1);
+                stream.writeRawData(hash.constData(), hash.size());
+            }
+        }
+
+        if (file.error() != QFileDevice::NoError || stream.status() != QDataStream::Ok) {
+            error = "Could not write " + target;
+            return false;
+        }
+
+        emit exportProgress(start + indices.size(), count);
+    }
+
+    return true;
+}
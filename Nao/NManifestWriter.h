@@ -0,0 +1,52 @@
+#ifndef NMANIFESTWRITER_H
+#define NMANIFESTWRITER_H
+
+#include <QObject>
+
+#include "NEntryReader.h"
+
+// exports a manifest of every entry in an archive, including a SHA-256 of its contents.
+// entries are hashed in parallel batches and written out as each batch completes,
+// so memory use doesn't depend on the number of entries.
+//
+// JSON Lines: one object per entry with index, path, offset, extraOffset, size,
+// extractedSize, ratio, type, bitrate and sha256.
+//
+// Binary (little-endian, QDataStream): "NAOM", quint32 version, quint64 count, then per entry:
+// QByteArray utf-8 path, qint64 offset, extraOffset, size, extractedSize, bitrate,
+// quint8 type (0 file, 1 video, 2 audio), quint8 flags (1 = hashed), 32 bytes SHA-256.
+
+class NManifestWriter : public QObject {
+        Q_OBJECT
+
+    public:
+        enum Format {
+            JSONLines,
+            Binary
+        };
+
+        explicit NManifestWriter(NEntryReader* reader) : QObject(), reader(reader) {}
+
+        bool write(const QString& target, Format format);
+
+        QString errorString() const { return error; }
+
+        static const quint32 BinaryVersion = 1;
+
+    signals:
+        void exportProgress(qint64 current, qint64 max);
+
+    private:
+        struct Record {
+            qint64 index;
+            NEntryReader::Info info;
+            QByteArray hash;
+        };
+
+        Record describe(qint64 index);
+
+        NEntryReader* reader;
+        QString error;
+};
+
+#endif // NMANIFESTWRITER_H
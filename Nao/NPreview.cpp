@@ -0,0 +1,441 @@
+#include "NPreview.h"
+#include "NCRILAYLA.h"
+
+#include <QtMath>
+
+// the most we decode for a hex or text preview
+
+static const qint64 PreviewBytes = 64 << 10;
+
+// images and audio need the whole entry, but only up to a point
+
+static const qint64 PreviewMaxBytes = 32 << 20;
+
+// decoded previews we keep around
+
+static const int PreviewCacheBytes = 64 << 20;
+
+static const int WaveformBuckets = 1024;
+static const int ImageMaxDimension = 2048;
+
+// lowest and highest sample per bucket, sample(f) being the first channel of frame f
+
+template <typename Sample>
+static QVector<qint16> bucketPeaks(qint64 frames, Sample sample) {
+    QVector<qint16> peaks(2 * WaveformBuckets);
+
+    for (int b = 0; b < WaveformBuckets; ++b) {
+        qint16 low = 0;
+        qint16 high = 0;
+
+        for (qint64 f = frames * b / WaveformBuckets; f < frames * (b + 1) / WaveformBuckets; ++f) {
+            qint16 s = sample(f);
+            low = qMin(low, s);
+            high = qMax(high, s);
+        }
+
+        peaks[2 * b] = low;
+        peaks[2 * b + 1] = high;
+    }
+
+    return peaks;
+}
+
+// the first channel of a CRI ADX stream (4-bit linear prediction, type 3), empty if
+// the header isn't one we know. data may end early, we decode as far as it goes.
+
+static QVector<qint16> decodeADX(const QByteArray& data) {
+    const uchar* p = reinterpret_cast<const uchar*>(data.constData());
+
+    if (data.size() < 0x14 || p[0] != 0x80 || p[1] != 0x00)
+        return QVector<qint16>();
+
+    qint64 dataOffset = qFromBigEndian<quint16>(p + 2) + 4;
+    int encoding = p[4];
+    int blockSize = p[5];
+    int bits = p[6];
+    int channels = p[7];
+    qint64 sampleRate = qFromBigEndian<quint32>(p + 8);
+    qint64 total = qFromBigEndian<quint32>(p + 12);
+    int highpass = qFromBigEndian<quint16>(p + 16);
+    int flags = p[19];
+
+    // the copyright string right before the audio tells a real header from lookalikes.
+    // encrypted streams set the flags byte, we can't do anything with those
+
+    if (dataOffset < 0x14 || dataOffset > data.size() || data.mid(dataOffset - 6, 6) != "(c)CRI" ||
+            encoding != 3 || bits != 4 || blockSize < 3 || channels == 0 || sampleRate == 0 || flags != 0)
+        return QVector<qint16>();
+
+    // prediction coefficients follow from the highpass cutoff, in 12-bit fixed point
+
+    double a = M_SQRT2 - qCos(2. * M_PI * highpass / sampleRate);
+    double b = M_SQRT2 - 1.;
+    double c = (a - qSqrt((a + b) * (a - b))) / b;
+    int coef1 = static_cast<int>(c * 8192.);
+    int coef2 = static_cast<int>(c * c * -4096.);
+
+    // each frame holds one block per channel: a 16-bit scale, then two samples per byte
+
+    qint64 frameBytes = static_cast<qint64>(blockSize) * channels;
+    int perBlock = (blockSize - 2) * 2;
+    int hist1 = 0;
+    int hist2 = 0;
+
+    QVector<qint16> samples;
+    samples.reserve(static_cast<int>(qMin<qint64>(total, (data.size() - dataOffset) / frameBytes * perBlock)));
+
+    for (qint64 pos = dataOffset; pos + blockSize <= data.size() && samples.size() < total; pos += frameBytes) {
+        int scale = qFromBigEndian<quint16>(p + pos);
+
+        // the end marker has the top bit set
+
+        if (scale & 0x8000)
+            break;
+
+        for (int i = 0; i < perBlock && samples.size() < total; ++i) {
+            uchar byte = p[pos + 2 + i / 2];
+            int nibble = (i & 1) ? (byte & 0x0F) : (byte >> 4);
+
+            if (nibble >= 8)
+                nibble -= 16;
+
+            int sample = qBound(-32768, nibble * scale + ((coef1 * hist1 + coef2 * hist2) >> 12), 32767);
+
+            hist2 = hist1;
+            hist1 = sample;
+            samples.append(static_cast<qint16>(sample));
+        }
+    }
+
+    return samples;
+}
+
+void NWaveform::paintEvent(QPaintEvent* e) {
+    Q_UNUSED(e);
+
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+
+    int buckets = peaks.size() / 2;
+
+    if (buckets == 0)
+        return;
+
+    qreal mid = height() / 2.;
+    qreal scale = mid / 32768.;
+
+    painter.setPen(palette().color(QPalette::Highlight));
+
+    // one vertical line per pixel column, from the lowest to the highest sample
+
+    for (int x = 0; x < width(); ++x) {
+        int bucket = static_cast<int>(static_cast<qint64>(x) * buckets / width());
+
+        painter.drawLine(QPointF(x, mid - peaks.at(2 * bucket + 1) * scale),
+                         QPointF(x, mid - peaks.at(2 * bucket) * scale));
+    }
+}
+
+int NPreview::Decoded::cost() const {
+    return static_cast<int>(sizeof(Decoded) +
+                            text.size() * sizeof(QChar) +
+                            image.sizeInBytes() +
+                            peaks.size() * sizeof(qint16));
+}
+
+NPreview::NPreview(QWidget* parent)
+    : QWidget(parent),
+    cache(PreviewCacheBytes) {
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    status = new QLabel(this);
+    stack = new QStackedWidget(this);
+    hexView = new QPlainTextEdit(stack);
+    textView = new QPlainTextEdit(stack);
+    imageView = new QLabel(stack);
+    waveView = new NWaveform(stack);
+
+    // fixed-width font so the hex columns line up
+
+    hexView->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    hexView->setReadOnly(true);
+    hexView->setLineWrapMode(QPlainTextEdit::NoWrap);
+    textView->setReadOnly(true);
+    imageView->setAlignment(Qt::AlignCenter);
+
+    // indices match Mode
+
+    stack->addWidget(hexView);
+    stack->addWidget(textView);
+    stack->addWidget(imageView);
+    stack->addWidget(waveView);
+
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(status);
+    layout->addWidget(stack, 1);
+
+    watcher = new QFutureWatcher<Decoded*>(this);
+
+    connect(watcher, &QFutureWatcher<Decoded*>::finished, this, &NPreview::decodeFinished);
+
+    clear();
+}
+
+void NPreview::setSource(NEntryReader* reader) {
+
+    // the running decode may still be using the old reader
+
+    watcher->waitForFinished();
+
+    ++generation;
+    source = reader;
+    cache.clear();
+    queuedIndex = -1;
+
+    clear();
+}
+
+void NPreview::clear() {
+    currentIndex = -1;
+
+    status->setText("No file selected");
+    hexView->clear();
+    textView->clear();
+    imageView->clear();
+    waveView->setPeaks(QVector<qint16>());
+    stack->setCurrentIndex(Hex);
+}
+
+void NPreview::showEntry(qint64 index, const QString& name) {
+    if (!source)
+        return;
+
+    currentIndex = index;
+
+    // QCache::object also marks the entry as most recently used
+
+    if (Decoded* d = cache.object(index)) {
+        queuedIndex = -1;
+        display(*d);
+        return;
+    }
+
+    status->setText("Loading " + name + "...");
+
+    if (watcher->isRunning()) {
+
+        // only the latest selection matters while scrolling
+
+        queuedIndex = index;
+        queuedName = name;
+    } else {
+        startDecode(index, name);
+    }
+}
+
+void NPreview::startDecode(qint64 index, const QString& name) {
+    watcher->setFuture(QtConcurrent::run(&NPreview::decode, source, generation, index, name));
+}
+
+void NPreview::decodeFinished() {
+    Decoded* d = watcher->result();
+
+    if (d->generation != generation) {
+
+        // decoded from a reader that has since been replaced
+
+        delete d;
+    } else {
+        if (d->index == currentIndex)
+            display(*d);
+
+        // keep it even if the selection moved on, so we never decode it twice
+
+        cache.insert(d->index, d, d->cost());
+    }
+
+    if (queuedIndex >= 0) {
+        qint64 index = queuedIndex;
+        queuedIndex = -1;
+
+        if (cache.contains(index)) {
+            if (index == currentIndex)
+                display(*cache.object(index));
+        } else {
+            startDecode(index, queuedName);
+        }
+    }
+}
+
+void NPreview::display(const Decoded& d) {
+    QString mode;
+
+    switch (d.mode) {
+        case Hex:
+            hexView->setPlainText(d.text);
+            mode = "Hex";
+            break;
+
+        case Text:
+            textView->setPlainText(d.text);
+            mode = "Text";
+            break;
+
+        case Image:
+            imageView->setPixmap(QPixmap::fromImage(d.image));
+            mode = "Image";
+            break;
+
+        case Waveform:
+            waveView->setPeaks(d.peaks);
+            mode = "Waveform";
+            break;
+    }
+
+    status->setText(mode + ", " + LibNao::Utils::getShortSize(d.size));
+    stack->setCurrentIndex(d.mode);
+}
+
+NPreview::Decoded* NPreview::decode(NEntryReader* reader, int generation, qint64 index, QString name) {
+    NAO_TRACE("preview");
+
+    Decoded* d = new Decoded;
+    d->generation = generation;
+    d->index = index;
+    d->size = reader->entrySize(index);
+    d->mode = Hex;
+
+    // a compressed entry is decoded back to front, so any range past its raw prefix costs
+    // about as much as the whole entry. unless it's small anyway, we sniff the prefix only
+
+    bool cheap = reader->hasRandomAccess(index) || d->size <= PreviewBytes;
+
+    QByteArray data = reader->read(index, cheap ? PreviewBytes : NCRILAYLA::PrefixSize);
+
+    // sniff the type from the first bytes, only then decide whether we need more
+
+    bool image = data.startsWith("\x89PNG") || data.startsWith("\xFF\xD8\xFF") ||
+            data.startsWith("BM") || data.startsWith("GIF8") || data.startsWith("DDS ");
+    bool wave = data.startsWith("RIFF") && data.mid(8, 4) == "WAVE";
+    bool adx = data.size() >= 2 && data.at(0) == '\x80' && data.at(1) == '\x00';
+
+    // images and audio need more than the first bytes. we decode a compressed entry
+    // whole only while it fits PreviewMaxBytes, beyond that it stays a hex preview
+
+    if ((image || wave || adx) && d->size > data.size() &&
+            (d->size <= PreviewMaxBytes || reader->hasRandomAccess(index)))
+        data = reader->read(index, PreviewMaxBytes);
+
+    if (image) {
+        QImage img = QImage::fromData(data);
+
+        if (!img.isNull()) {
+            if (img.width() > ImageMaxDimension || img.height() > ImageMaxDimension)
+                img = img.scaled(ImageMaxDimension, ImageMaxDimension, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+            d->mode = Image;
+            d->image = img;
+
+            return d;
+        }
+    }
+
+    if (wave) {
+
+        // walk the RIFF chunks looking for 16-bit PCM
+
+        const uchar* p = reinterpret_cast<const uchar*>(data.constData());
+        qint64 pos = 12;
+        int channels = 0;
+        int bits = 0;
+        int format = 0;
+
+        while (pos + 8 <= data.size()) {
+            QByteArray id = data.mid(pos, 4);
+            qint64 size = qFromLittleEndian<quint32>(p + pos + 4);
+            pos += 8;
+
+            if (id == "fmt " && size >= 16 && pos + 16 <= data.size()) {
+                format = qFromLittleEndian<quint16>(p + pos);
+                channels = qFromLittleEndian<quint16>(p + pos + 2);
+                bits = qFromLittleEndian<quint16>(p + pos + 14);
+            } else if (id == "data" && format == 1 && bits == 16 && channels > 0) {
+                qint64 frames = (qMin(size, data.size() - pos)) / (2 * channels);
+                const qint16* samples = reinterpret_cast<const qint16*>(p + pos);
+
+                d->peaks = bucketPeaks(frames, [=](qint64 f) {
+                    return qFromLittleEndian<qint16>(samples + f * channels);
+                });
+                d->mode = Waveform;
+
+                return d;
+            }
+
+            // chunks are word-aligned
+
+            pos += size + (size & 1);
+        }
+    }
+
+    if (adx) {
+        QVector<qint16> samples = decodeADX(data);
+
+        if (!samples.isEmpty()) {
+            d->peaks = bucketPeaks(samples.size(), [&](qint64 f) {
+                return samples.at(static_cast<int>(f));
+            });
+            d->mode = Waveform;
+
+            return d;
+        }
+    }
+
+    data.truncate(PreviewBytes);
+
+    // treat it as text if there are no control characters besides whitespace
+
+    bool text = !data.isEmpty() && !name.endsWith(".adx", Qt::CaseInsensitive);
+
+    for (int i = 0; text && i < data.size(); ++i) {
+        uchar c = static_cast<uchar>(data.at(i));
+
+        if (c < 0x09 || (c > 0x0D && c < 0x20) || c == 0x7F)
+            text = false;
+    }
+
+    if (text) {
+        d->mode = Text;
+        d->text = QString::fromUtf8(data);
+
+        return d;
+    }
+
+    // classic 16 bytes per line hex dump
+
+    QString hex;
+    hex.reserve((data.size() / 16 + 1) * 78);
+
+    for (int line = 0; line < data.size(); line += 16) {
+        QString ascii;
+
+        hex += QString("%1  ").arg(line, 8, 16, QChar('0'));
+
+        for (int i = line; i < line + 16; ++i) {
+            if (i < data.size()) {
+                uchar c = static_cast<uchar>(data.at(i));
+
+                hex += QString("%1 ").arg(c, 2, 16, QChar('0'));
+                ascii += (c >= 0x20 && c < 0x7F) ? QChar(c) : QChar('.');
+            } else {
+                hex += "   ";
+            }
+        }
+
+        hex += " " + ascii + "\n";
+    }
+
+    d->text = hex;
+
+    return d;
+}
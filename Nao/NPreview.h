@@ -0,0 +1,96 @@
+#ifndef NPREVIEW_H
+#define NPREVIEW_H
+
+#include <QtConcurrent/QtConcurrent>
+
+#include <QWidget>
+#include <QCache>
+#include <QImage>
+#include <QLabel>
+#include <QPlainTextEdit>
+#include <QStackedWidget>
+#include <QVBoxLayout>
+#include <QPainter>
+#include <QPixmap>
+#include <QFontDatabase>
+#include <QtEndian>
+
+#include "NEntryReader.h"
+#include "NTrace.h"
+
+// draws min/max peaks of a decoded waveform
+
+class NWaveform : public QWidget {
+    public:
+        explicit NWaveform(QWidget* parent = nullptr) : QWidget(parent) {}
+
+        void setPeaks(const QVector<qint16>& p) { peaks = p; update(); }
+
+    protected:
+        void paintEvent(QPaintEvent* e) override;
+
+    private:
+        QVector<qint16> peaks; // alternating min, max per bucket
+};
+
+class NPreview : public QWidget {
+        Q_OBJECT
+
+    public:
+        explicit NPreview(QWidget* parent = nullptr);
+
+        // a new source invalidates everything we have cached
+
+        void setSource(NEntryReader* reader);
+        void showEntry(qint64 index, const QString& name);
+        void clear();
+
+    private:
+        enum Mode {
+            Hex,
+            Text,
+            Image,
+            Waveform
+        };
+
+        struct Decoded {
+            int generation;
+            qint64 index;
+            qint64 size;
+            Mode mode;
+            QString text;
+            QImage image;
+            QVector<qint16> peaks;
+
+            int cost() const;
+        };
+
+        static Decoded* decode(NEntryReader* reader, int generation, qint64 index, QString name);
+
+        void startDecode(qint64 index, const QString& name);
+        void display(const Decoded& d);
+        void decodeFinished();
+
+        NEntryReader* source = nullptr;
+
+        // decoded previews, bounded by their approximate size in bytes
+
+        QCache<qint64, Decoded> cache;
+
+        // only one decode runs at a time, the most recent request waits for it
+
+        QFutureWatcher<Decoded*>* watcher = nullptr;
+        qint64 currentIndex = -1;
+        qint64 queuedIndex = -1;
+        QString queuedName;
+        int generation = 0;
+
+        QLabel* status          = nullptr;
+        QStackedWidget* stack   = nullptr;
+        QPlainTextEdit* hexView = nullptr;
+        QPlainTextEdit* textView = nullptr;
+        QLabel* imageView       = nullptr;
+        NWaveform* waveView     = nullptr;
+};
+
+#endif // NPREVIEW_H
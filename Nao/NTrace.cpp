@@ -0,0 +1,233 @@
+#include "NTrace.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QVector>
+#include <QMap>
+#include <QFile>
+
+namespace {
+
+    // per thread, older events get overwritten once a ring is full
+
+    const quint64 RingSize = 1 << 16;
+
+    struct Event {
+        const char* stage;
+        qint64 start;
+        qint64 end;
+    };
+
+    // exporting reads the rings while their threads keep recording, so every slot is a
+    // seqlock: sequence is 0 while the slot is written and the event's number + 1 once
+    // it's complete. a copy only counts if the sequence was the same before and after.
+
+    struct Slot {
+        std::atomic<quint64> sequence { 0 };
+        std::atomic<const char*> stage { nullptr };
+        std::atomic<qint64> start { 0 };
+        std::atomic<qint64> end { 0 };
+    };
+
+    struct Ring {
+        int thread;
+        std::atomic<quint64> written { 0 };
+        Slot events[RingSize];
+    };
+
+    QMutex registryMutex;
+    QVector<Ring*> rings;
+
+    thread_local Ring* localRing = nullptr;
+
+    // the job accumulator this thread adds to, if any
+
+    thread_local void* localTotals = nullptr;
+
+    const QElapsedTimer& traceClock() {
+        static const QElapsedTimer timer = []() {
+            QElapsedTimer t;
+            t.start();
+            return t;
+        }();
+
+        return timer;
+    }
+
+    Ring* ring() {
+        if (!localRing) {
+
+            // rings are never freed, pool threads come and go but their events stay readable
+
+            Ring* r = new Ring;
+
+            QMutexLocker lock(&registryMutex);
+            r->thread = rings.size();
+            rings.append(r);
+
+            localRing = r;
+        }
+
+        return localRing;
+    }
+
+    // visit every event still in the buffers. events overwritten while we read are skipped
+
+    template <typename F> void forEachEvent(F f) {
+        QMutexLocker lock(&registryMutex);
+
+        for (const Ring* r : rings) {
+            quint64 written = r->written.load(std::memory_order_acquire);
+
+            for (quint64 i = (written > RingSize) ? written - RingSize : 0; i < written; ++i) {
+                const Slot& slot = r->events[i % RingSize];
+
+                if (slot.sequence.load(std::memory_order_acquire) != i + 1)
+                    continue;
+
+                Event e = { slot.stage.load(std::memory_order_relaxed),
+                            slot.start.load(std::memory_order_relaxed),
+                            slot.end.load(std::memory_order_relaxed) };
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (slot.sequence.load(std::memory_order_relaxed) == i + 1)
+                    f(r->thread, e);
+            }
+        }
+    }
+}
+
+std::atomic<bool> NTrace::active(qEnvironmentVariableIsSet("NAO_TRACE"));
+
+qint64 NTrace::now() {
+    return traceClock().nsecsElapsed();
+}
+
+void NTrace::record(const char* stage, qint64 start, qint64 end) {
+    Ring* r = ring();
+    quint64 n = r->written.load(std::memory_order_relaxed);
+    Slot& slot = r->events[n % RingSize];
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.stage.store(stage, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+
+    slot.sequence.store(n + 1, std::memory_order_release);
+    r->written.store(n + 1, std::memory_order_release);
+
+    if (localTotals)
+        static_cast<NTraceJob::Totals*>(localTotals)->add(stage, end - start);
+}
+
+NTraceJob::~NTraceJob() {
+    clear();
+}
+
+void NTraceJob::clear() {
+    QMutexLocker lock(&mutex);
+
+    qDeleteAll(totals);
+    totals.clear();
+}
+
+NTraceJob::Totals* NTraceJob::attach() {
+
+    // pool workers attach for every wave, rings are never reused so their number tells
+    // threads apart for good, unlike a thread id the system may hand out again
+
+    const int thread = ring()->thread;
+
+    QMutexLocker lock(&mutex);
+    Totals*& t = totals[thread];
+
+    if (!t)
+        t = new Totals;
+
+    return t;
+}
+
+void NTraceJob::Totals::add(const char* stage, qint64 nsecs) {
+
+    // a handful of stages, and literals of the same name usually share their address
+
+    for (Stage& s : stages) {
+        if (s.name == stage) {
+            s.count += 1;
+            s.nsecs += nsecs;
+            return;
+        }
+    }
+
+    stages.append({ stage, 1, nsecs });
+}
+
+NTraceJob::Attach::Attach(NTraceJob* job)
+    : previous(localTotals) {
+
+    // when tracing is off nothing gets recorded, so there's nothing to set up either
+
+    if (job && NTrace::enabled())
+        localTotals = job->attach();
+}
+
+NTraceJob::Attach::~Attach() {
+    localTotals = previous;
+}
+
+QString NTraceJob::summary() const {
+    QMap<QByteArray, QPair<qint64, qint64>> stages;
+    QMutexLocker lock(&mutex);
+
+    for (const Totals* t : totals) {
+        for (const Stage& s : t->stages) {
+            QPair<qint64, qint64>& merged = stages[s.name];
+            merged.first += s.count;
+            merged.second += s.nsecs;
+        }
+    }
+
+    // nested stages are counted in their parent as well
+
+    QString result;
+
+    for (auto it = stages.constBegin(); it != stages.constEnd(); ++it) {
+        result += QString("%0:\t%1 ms (%2x)\n")
+                .arg(QString(it.key()))
+                .arg(it.value().second / 1e6, 0, 'f', 1)
+                .arg(it.value().first);
+    }
+
+    return result;
+}
+
+bool NTrace::writeChromeTrace() {
+    QFile file(QString::fromLocal8Bit(qgetenv("NAO_TRACE")));
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    // complete ("X") events, timestamps in microseconds
+
+    QByteArray json = "{\"traceEvents\":[\n";
+    bool first = true;
+
+    forEachEvent([&](int thread, const Event& e) {
+        if (!first)
+            json += ",\n";
+
+        json += "{\"name\":\"" + QByteArray(e.stage) +
+                "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + QByteArray::number(thread) +
+                ",\"ts\":" + QByteArray::number(e.start / 1e3, 'f', 3) +
+                ",\"dur\":" + QByteArray::number((e.end - e.start) / 1e3, 'f', 3) + "}";
+
+        first = false;
+    });
+
+    json += "\n]}\n";
+
+    return file.write(json) == json.size();
+}
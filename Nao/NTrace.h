@@ -0,0 +1,117 @@
+#ifndef NTRACE_H
+#define NTRACE_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QMutex>
+
+#include <atomic>
+
+// lightweight scoped timers. tracing is switched on by setting NAO_TRACE to the path
+// of a Chrome trace file (chrome://tracing, Perfetto), when it's off a scope costs one load.
+
+namespace NTrace {
+    extern std::atomic<bool> active;
+
+    inline bool enabled() {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    // nanoseconds since the process started tracing
+
+    qint64 now();
+
+    // stage names must be string literals, only the pointer is stored
+
+    void record(const char* stage, qint64 start, qint64 end);
+
+    // write everything still in the ring buffers to the NAO_TRACE file
+
+    bool writeChromeTrace();
+}
+
+// running totals per stage for one job (an extraction, say), kept apart from the rings
+// so a long job doesn't lose its first stages to overwritten events. every thread adds
+// to its own accumulator while attached, summary() merges them once the job is done.
+
+class NTraceJob {
+    public:
+        NTraceJob() = default;
+        ~NTraceJob();
+
+        NTraceJob(const NTraceJob&) = delete;
+        NTraceJob& operator=(const NTraceJob&) = delete;
+
+        // stages recorded on this thread while an Attach lives count towards the job.
+        // attaching again from the same thread adds to what it recorded before
+
+        class Attach {
+            public:
+                explicit Attach(NTraceJob* job);
+                ~Attach();
+
+                Attach(const Attach&) = delete;
+                Attach& operator=(const Attach&) = delete;
+
+            private:
+                void* previous;
+        };
+
+        // forget everything, only while no thread is attached
+
+        void clear();
+
+        // total time and count per stage, only once no thread is attached anymore
+
+        QString summary() const;
+
+    private:
+        struct Stage {
+            const char* name;
+            qint64 count;
+            qint64 nsecs;
+        };
+
+        struct Totals {
+            QVector<Stage> stages;
+
+            void add(const char* stage, qint64 nsecs);
+        };
+
+        friend void NTrace::record(const char* stage, qint64 start, qint64 end);
+
+        Totals* attach();
+
+        // one per thread, however often it attaches
+
+        mutable QMutex mutex;
+        QHash<int, Totals*> totals;
+};
+
+class NTraceScope {
+    public:
+        explicit NTraceScope(const char* stage)
+            : stage(NTrace::enabled() ? stage : nullptr),
+            start(this->stage ? NTrace::now() : 0) {
+
+        }
+
+        ~NTraceScope() {
+            if (stage)
+                NTrace::record(stage, start, NTrace::now());
+        }
+
+        NTraceScope(const NTraceScope&) = delete;
+        NTraceScope& operator=(const NTraceScope&) = delete;
+
+    private:
+        const char* stage;
+        qint64 start;
+};
+
+#define NAO_TRACE_CONCAT_(a, b) a##b
+#define NAO_TRACE_CONCAT(a, b) NAO_TRACE_CONCAT_(a, b)
+#define NAO_TRACE(stage) NTraceScope NAO_TRACE_CONCAT(nTraceScope, __LINE__)(stage)
+
+#endif // NTRACE_H
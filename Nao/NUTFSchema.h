@@ -0,0 +1,220 @@
+#ifndef NUTFSCHEMA_H
+#define NUTFSCHEMA_H
+
+#include <QtEndian>
+#include <QVector>
+
+#include <limits>
+
+#include "NUTFTable.h"
+
+// compile-time decoders for @UTF tables with a known layout. a schema lists the columns
+// it wants, the type each one normally has and the member of its row struct it goes into.
+// if a table matches, every cell is read with its width and byte order compiled in and
+// written straight into the rows, skipping the per-cell type dispatch and QVariant of
+// NUTFTable::value(). tables that don't match (other types, zero-storage columns) are
+// decoded through NUTFTable instead, so the result is the same either way.
+
+// a single cell of a known type
+
+template <NUTFTable::Type T> struct NUTFCell;
+
+template <> struct NUTFCell<NUTFTable::UInt8> {
+    static quint8 read(const uchar* p, const NUTFTable&) { return p[0]; }
+};
+
+template <> struct NUTFCell<NUTFTable::Int8> {
+    static qint8 read(const uchar* p, const NUTFTable&) { return static_cast<qint8>(p[0]); }
+};
+
+template <> struct NUTFCell<NUTFTable::UInt16> {
+    static quint16 read(const uchar* p, const NUTFTable&) { return qFromBigEndian<quint16>(p); }
+};
+
+template <> struct NUTFCell<NUTFTable::Int16> {
+    static qint16 read(const uchar* p, const NUTFTable&) { return qFromBigEndian<qint16>(p); }
+};
+
+template <> struct NUTFCell<NUTFTable::UInt32> {
+    static quint32 read(const uchar* p, const NUTFTable&) { return qFromBigEndian<quint32>(p); }
+};
+
+template <> struct NUTFCell<NUTFTable::Int32> {
+    static qint32 read(const uchar* p, const NUTFTable&) { return qFromBigEndian<qint32>(p); }
+};
+
+template <> struct NUTFCell<NUTFTable::UInt64> {
+    static quint64 read(const uchar* p, const NUTFTable&) { return qFromBigEndian<quint64>(p); }
+};
+
+template <> struct NUTFCell<NUTFTable::Int64> {
+    static qint64 read(const uchar* p, const NUTFTable&) { return qFromBigEndian<qint64>(p); }
+};
+
+template <> struct NUTFCell<NUTFTable::String> {
+    static QByteArray read(const uchar* p, const NUTFTable& table) {
+        return table.string(qFromBigEndian<quint32>(p));
+    }
+};
+
+// one column of a schema, optional columns that are missing leave the member untouched
+
+template <typename Row, typename Value, Value Row::*Member, NUTFTable::Type T, bool Required = true>
+struct NUTFField {
+    static const NUTFTable::Type type = T;
+    static const bool required = Required;
+
+    static void read(Row& row, const uchar* cell, const NUTFTable& table) {
+        row.*Member = static_cast<Value>(NUTFCell<T>::read(cell, table));
+    }
+
+    static void readGeneric(Row& row, const NUTFTable& table, qint64 index, int column) {
+        row.*Member = qvariant_cast<Value>(table.value(index, column));
+    }
+};
+
+// where a field's cells are: base + row * stride, constants have a stride of 0
+
+struct NUTFCellLayout {
+    const uchar* base;
+    qint64 stride;
+};
+
+template <typename Row, int I, typename... Fields>
+struct NUTFFieldList {
+    static bool match(const NUTFTable&, const char* const*, int*, NUTFCellLayout*, bool&) {
+        return true;
+    }
+
+    static void read(Row&, const NUTFCellLayout*, qint64, const NUTFTable&) {}
+    static void readConstants(Row&, const NUTFCellLayout*, const NUTFTable&) {}
+    static void readGeneric(Row&, const NUTFTable&, const int*, qint64) {}
+};
+
+template <typename Row, int I, typename Field, typename... Rest>
+struct NUTFFieldList<Row, I, Field, Rest...> {
+    using Next = NUTFFieldList<Row, I + 1, Rest...>;
+
+    static bool match(const NUTFTable& table, const char* const* names, int* columns,
+                      NUTFCellLayout* layout, bool& fast) {
+        int column = table.columnIndex(names[I]);
+
+        columns[I] = column;
+        layout[I] = { nullptr, 0 };
+
+        if (column < 0) {
+            if (Field::required)
+                return false;
+        } else {
+            const NUTFTable::Column& c = table.column(column);
+            const uchar* data = reinterpret_cast<const uchar*>(table.bytes().constData());
+
+            if (c.type != Field::type) {
+                fast = false;
+            } else if (c.storage == NUTFTable::PerRow) {
+                layout[I] = { data + table.rowsStart() + c.offset, table.rowSize() };
+            } else if (c.storage == NUTFTable::Constant || c.storage == NUTFTable::Constant2) {
+                layout[I] = { data + c.offset, 0 };
+            } else {
+                fast = false;
+            }
+        }
+
+        return Next::match(table, names, columns, layout, fast);
+    }
+
+    static void read(Row& row, const NUTFCellLayout* layout, qint64 index, const NUTFTable& table) {
+        if (layout[I].stride)
+            Field::read(row, layout[I].base + index * layout[I].stride, table);
+
+        Next::read(row, layout, index, table);
+    }
+
+    static void readConstants(Row& row, const NUTFCellLayout* layout, const NUTFTable& table) {
+        if (layout[I].base && !layout[I].stride)
+            Field::read(row, layout[I].base, table);
+
+        Next::readConstants(row, layout, table);
+    }
+
+    static void readGeneric(Row& row, const NUTFTable& table, const int* columns, qint64 index) {
+        if (columns[I] >= 0)
+            Field::readGeneric(row, table, index, columns[I]);
+
+        Next::readGeneric(row, table, columns, index);
+    }
+};
+
+// Schema provides columnNames(), in the same order as Fields
+
+template <typename Schema, typename Row, typename... Fields>
+struct NUTFSchema {
+    using RowType = Row;
+
+    // false if the table is invalid, lacks a required column or has more rows than a QVector holds.
+    // specialized tells whether the compiled path was taken.
+
+    static bool read(const NUTFTable& table, QVector<Row>& rows, bool* specialized = nullptr) {
+        using List = NUTFFieldList<Row, 0, Fields...>;
+
+        int columns[sizeof...(Fields)];
+        NUTFCellLayout layout[sizeof...(Fields)];
+        bool fast = true;
+
+        if (!table.isValid() || !List::match(table, Schema::columnNames(), columns, layout, fast))
+            return false;
+
+        // a QVector is indexed by int, rows of zero-storage columns take no space to claim that many
+
+        if (table.rowCount() > std::numeric_limits<int>::max())
+            return false;
+
+        if (fast) {
+
+            // constants are decoded once, every row then shares them
+
+            Row prototype;
+            List::readConstants(prototype, layout, table);
+
+            rows.fill(prototype, static_cast<int>(table.rowCount()));
+
+            for (int i = 0; i < rows.size(); ++i)
+                List::read(rows[i], layout, i, table);
+        } else {
+            rows.resize(static_cast<int>(table.rowCount()));
+
+            for (int i = 0; i < rows.size(); ++i)
+                List::readGeneric(rows[i], table, columns, i);
+        }
+
+        if (specialized)
+            *specialized = fast;
+
+        return true;
+    }
+};
+
+// CPK TOC, one row per file
+
+struct NTOCRow {
+    QByteArray dirName;
+    QByteArray fileName;
+    qint64 fileOffset = 0;
+    qint64 fileSize = 0;
+    qint64 extractSize = 0;
+};
+
+struct NTOCSchema : NUTFSchema<NTOCSchema, NTOCRow,
+        NUTFField<NTOCRow, QByteArray, &NTOCRow::dirName, NUTFTable::String, false>,
+        NUTFField<NTOCRow, QByteArray, &NTOCRow::fileName, NUTFTable::String>,
+        NUTFField<NTOCRow, qint64, &NTOCRow::fileOffset, NUTFTable::UInt64>,
+        NUTFField<NTOCRow, qint64, &NTOCRow::fileSize, NUTFTable::UInt32>,
+        NUTFField<NTOCRow, qint64, &NTOCRow::extractSize, NUTFTable::UInt32>> {
+
+    static const char* const* columnNames() {
+        static const char* const names[] = { "DirName", "FileName", "FileOffset", "FileSize", "ExtractSize" };
+        return names;
+    }
+};
+
+#endif // NUTFSCHEMA_H
@@ -0,0 +1,334 @@
+#include "NUTFTable.h"
+
+#include <QtEndian>
+
+#include <cstring>
+
+// every offset in the header counts from the byte after the table size
+
+static const qint64 UTFBase = 8;
+static const qint64 UTFHeaderSize = 0x20;
+
+NUTFTable::NUTFTable(const QByteArray& table)
+    : data(table) {
+
+    if (data.size() < UTFHeaderSize)
+        return;
+
+    if (!data.startsWith("@UTF")) {
+        data = decrypt(data);
+        encrypted = true;
+
+        if (!data.startsWith("@UTF"))
+            return;
+    }
+
+    const uchar* p = reinterpret_cast<const uchar*>(data.constData());
+
+    // the upper half of the rows offset field is a version number in newer tables
+
+    rowsOffset = UTFBase + qFromBigEndian<quint16>(p + 10);
+    stringsOffset = UTFBase + qFromBigEndian<quint32>(p + 12);
+    dataOffset = UTFBase + qFromBigEndian<quint32>(p + 16);
+
+    quint32 nameOffset = qFromBigEndian<quint32>(p + 20);
+    int columnCount = qFromBigEndian<quint16>(p + 24);
+    rowLength = qFromBigEndian<quint16>(p + 26);
+    rows = qFromBigEndian<quint32>(p + 28);
+
+    if (stringsOffset > data.size() || dataOffset > data.size() ||
+            rowsOffset + rows * rowLength > data.size())
+        return;
+
+    // every string has to start inside the table, or the table is rejected
+
+    if (!hasString(nameOffset))
+        return;
+
+    tableName = string(nameOffset);
+
+    qint64 pos = UTFHeaderSize;
+    qint64 rowPos = 0;
+
+    for (int i = 0; i < columnCount; ++i) {
+        if (pos + 5 > rowsOffset)
+            return;
+
+        Column column;
+        quint8 flags = p[pos];
+
+        column.type = static_cast<Type>(flags & 0x0F);
+        column.storage = static_cast<Storage>(flags & 0xF0);
+        quint32 columnName = qFromBigEndian<quint32>(p + pos + 1);
+
+        if (!hasString(columnName))
+            return;
+
+        column.name = string(columnName);
+
+        int size = typeSize(column.type);
+
+        if (size < 0)
+            return;
+
+        pos += 5;
+
+        switch (column.storage) {
+            case Zero:
+                column.offset = -1;
+                break;
+
+            case Constant:
+            case Constant2:
+
+                // constants live in the column list itself, before the rows
+
+                if (pos + size > rowsOffset)
+                    return;
+
+                if (column.type == String && !hasString(qFromBigEndian<quint32>(p + pos)))
+                    return;
+
+                column.offset = pos;
+                pos += size;
+                break;
+
+            case PerRow:
+                column.offset = rowPos;
+                rowPos += size;
+                break;
+
+            default:
+                return;
+        }
+
+        columns.append(column);
+    }
+
+    if (rowPos > rowLength)
+        return;
+
+    // string cells are checked once here so reading them later needs no error path
+
+    for (const Column& column : columns) {
+        if (column.type != String || column.storage != PerRow)
+            continue;
+
+        for (qint64 row = 0; row < rows; ++row) {
+            if (!hasString(qFromBigEndian<quint32>(p + rowsOffset + row * rowLength + column.offset)))
+                return;
+        }
+    }
+
+    valid = true;
+}
+
+int NUTFTable::columnIndex(const QByteArray& name) const {
+    for (int i = 0; i < columns.size(); ++i) {
+        if (columns.at(i).name == name)
+            return i;
+    }
+
+    return -1;
+}
+
+QVariant NUTFTable::value(qint64 row, const QByteArray& column) const {
+    int index = columnIndex(column);
+
+    return (index < 0) ? QVariant() : value(row, index);
+}
+
+QVariant NUTFTable::value(qint64 row, int column) const {
+    const Column& c = columns.at(column);
+
+    switch (c.storage) {
+        case Zero:
+            return read(-1, c.type);
+
+        case Constant:
+        case Constant2:
+            return read(c.offset, c.type);
+
+        case PerRow:
+            return read(cellOffset(row, column), c.type);
+    }
+
+    return QVariant();
+}
+
+qint64 NUTFTable::cellOffset(qint64 row, int column) const {
+    const Column& c = columns.at(column);
+
+    if (c.storage != PerRow || row < 0 || row >= rows)
+        return -1;
+
+    return rowsOffset + row * rowLength + c.offset;
+}
+
+QVariant NUTFTable::read(qint64 offset, Type type) const {
+    const uchar* p = reinterpret_cast<const uchar*>(data.constData()) + offset;
+
+    // zero-storage columns have a type but no data
+
+    if (offset < 0) {
+        switch (type) {
+            case String:
+                return QByteArray();
+
+            case Data:
+                return QByteArray();
+
+            case Float:
+            case Double:
+                return 0.;
+
+            default:
+                return 0;
+        }
+    }
+
+    switch (type) {
+        case UInt8:
+            return static_cast<quint32>(p[0]);
+
+        case Int8:
+            return static_cast<qint32>(static_cast<qint8>(p[0]));
+
+        case UInt16:
+            return static_cast<quint32>(qFromBigEndian<quint16>(p));
+
+        case Int16:
+            return static_cast<qint32>(qFromBigEndian<qint16>(p));
+
+        case UInt32:
+            return qFromBigEndian<quint32>(p);
+
+        case Int32:
+            return qFromBigEndian<qint32>(p);
+
+        case UInt64:
+            return qFromBigEndian<quint64>(p);
+
+        case Int64:
+            return qFromBigEndian<qint64>(p);
+
+        case Float: {
+            quint32 bits = qFromBigEndian<quint32>(p);
+            float f;
+            std::memcpy(&f, &bits, sizeof(f));
+            return f;
+        }
+
+        case Double: {
+            quint64 bits = qFromBigEndian<quint64>(p);
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return d;
+        }
+
+        case String:
+            return string(qFromBigEndian<quint32>(p));
+
+        case Data:
+            return data.mid(dataOffset + qFromBigEndian<quint32>(p), qFromBigEndian<quint32>(p + 4));
+    }
+
+    return QVariant();
+}
+
+QByteArray NUTFTable::string(quint64 offset) const {
+    if (!hasString(offset))
+        return QByteArray();
+
+    const char* s = data.constData() + stringsOffset + offset;
+
+    return QByteArray(s, static_cast<int>(qstrnlen(s, static_cast<uint>(data.size() - stringsOffset - offset))));
+}
+
+bool NUTFTable::hasString(quint64 offset) const {
+    return offset < static_cast<quint64>(data.size() - stringsOffset);
+}
+
+bool NUTFTable::writeInteger(QByteArray& table, qint64 offset, Type type, quint64 value) {
+    int size = typeSize(type);
+
+    if (offset < 0 || size < 0 || offset + size > table.size())
+        return false;
+
+    // a value that doesn't fit the cell is an error, not something to cut down to size.
+    // signed cells take value as a qint64
+
+    if (size < 8) {
+        const qint64 limit = Q_INT64_C(1) << (8 * size - 1);
+        const qint64 signedValue = static_cast<qint64>(value);
+
+        if ((type == Int8 || type == Int16 || type == Int32) ? (signedValue < -limit || signedValue >= limit)
+                                                            : (value >> (8 * size)) != 0)
+            return false;
+    }
+
+    uchar* p = reinterpret_cast<uchar*>(table.data()) + offset;
+
+    switch (type) {
+        case UInt8:
+        case Int8:
+            p[0] = static_cast<uchar>(value);
+            return true;
+
+        case UInt16:
+        case Int16:
+            qToBigEndian<quint16>(static_cast<quint16>(value), p);
+            return true;
+
+        case UInt32:
+        case Int32:
+            qToBigEndian<quint32>(static_cast<quint32>(value), p);
+            return true;
+
+        case UInt64:
+        case Int64:
+            qToBigEndian<quint64>(value, p);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+int NUTFTable::typeSize(Type type) {
+    switch (type) {
+        case UInt8:
+        case Int8:
+            return 1;
+
+        case UInt16:
+        case Int16:
+            return 2;
+
+        case UInt32:
+        case Int32:
+        case Float:
+        case String:
+            return 4;
+
+        case UInt64:
+        case Int64:
+        case Double:
+        case Data:
+            return 8;
+    }
+
+    return -1;
+}
+
+QByteArray NUTFTable::decrypt(const QByteArray& table) {
+    QByteArray result(table);
+    quint32 m = 0x655F;
+
+    for (int i = 0; i < result.size(); ++i) {
+        result[i] = static_cast<char>(result.at(i) ^ (m & 0xFF));
+        m *= 0x4115;
+    }
+
+    return result;
+}
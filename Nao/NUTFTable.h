@@ -0,0 +1,104 @@
+#ifndef NUTFTABLE_H
+#define NUTFTABLE_H
+
+#include <QByteArray>
+#include <QVariant>
+#include <QVector>
+
+// read access to a CRIWare @UTF table, the format used for CPK headers, TOCs and USM metadata.
+// all values are big-endian, and the cell layout is fixed per column.
+
+class NUTFTable {
+    public:
+        enum Type {
+            UInt8   = 0x0,
+            Int8    = 0x1,
+            UInt16  = 0x2,
+            Int16   = 0x3,
+            UInt32  = 0x4,
+            Int32   = 0x5,
+            UInt64  = 0x6,
+            Int64   = 0x7,
+            Float   = 0x8,
+            Double  = 0x9,
+            String  = 0xA,
+            Data    = 0xB
+        };
+
+        enum Storage {
+            Zero        = 0x10,
+            Constant    = 0x30,
+            PerRow      = 0x50,
+            Constant2   = 0x70
+        };
+
+        struct Column {
+            QByteArray name;
+            Type type;
+            Storage storage;
+            qint64 offset; // within the row for PerRow, absolute for constants
+        };
+
+        // table must start with "@UTF" (or its encrypted form)
+
+        explicit NUTFTable(const QByteArray& table);
+
+        bool isValid() const { return valid; }
+        bool wasEncrypted() const { return encrypted; }
+
+        // the decrypted table bytes, offsets below are relative to this
+
+        const QByteArray& bytes() const { return data; }
+
+        QByteArray name() const { return tableName; }
+        qint64 rowCount() const { return rows; }
+        int columnCount() const { return columns.size(); }
+        const Column& column(int i) const { return columns.at(i); }
+        int columnIndex(const QByteArray& name) const;
+
+        QVariant value(qint64 row, int column) const;
+        QVariant value(qint64 row, const QByteArray& column) const;
+
+        // position of a cell in bytes(), or -1 if the column isn't stored per row
+
+        qint64 cellOffset(qint64 row, int column) const;
+
+        // raw layout, for the compiled readers in NUTFSchema.h
+
+        qint64 rowsStart() const { return rowsOffset; }
+        qint64 rowSize() const { return rowLength; }
+
+        // a string from the string area, cut off at the end of the table. every string
+        // offset in a valid table is within it, anything else comes back empty.
+
+        QByteArray string(quint64 offset) const;
+
+        // overwrite an integer cell in a table buffer, false if value doesn't fit the type
+
+        static bool writeInteger(QByteArray& table, qint64 offset, Type type, quint64 value);
+
+        static int typeSize(Type type);
+
+        // the XOR scheme is symmetric, so this also encrypts
+
+        static QByteArray decrypt(const QByteArray& table);
+
+    private:
+        QVariant read(qint64 offset, Type type) const;
+        bool hasString(quint64 offset) const;
+
+        QByteArray data;
+        bool valid = false;
+        bool encrypted = false;
+
+        QByteArray tableName;
+        qint64 rows = 0;
+        qint64 rowLength = 0;
+        qint64 rowsOffset = 0;
+        qint64 stringsOffset = 0;
+        qint64 dataOffset = 0;
+
+        QVector<Column> columns;
+};
+
+#endif // NUTFTABLE_H
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -26,10 +26,41 @@ win32:RC_ICONS += Nao.ico
 
 SOURCES += \
         main.cpp \
-        NMain.cpp
+        NMain.cpp \
+        NEntryReader.cpp \
+        NPreview.cpp \
+        NUTFTable.cpp \
+        NCRILAYLA.cpp \
+        NArchiveWriter.cpp \
+        NDATWriter.cpp \
+        NCPKWriter.cpp \
+        NTrace.cpp \
+        NArchiveServer.cpp \
+        NHashingDevice.cpp \
+        NManifestWriter.cpp \
+        NExtractor.cpp \
+        NBlobStore.cpp \
+        NDaemon.cpp \
+        NConcurrencyTuner.cpp
 
 HEADERS += \
-        NMain.h
+        NMain.h \
+        NEntryReader.h \
+        NPreview.h \
+        NUTFTable.h \
+        NUTFSchema.h \
+        NCRILAYLA.h \
+        NArchiveWriter.h \
+        NDATWriter.h \
+        NCPKWriter.h \
+        NTrace.h \
+        NArchiveServer.h \
+        NHashingDevice.h \
+        NManifestWriter.h \
+        NExtractor.h \
+        NBlobStore.h \
+        NDaemon.h \
+        NConcurrencyTuner.h
 
 INCLUDEPATH += $$PWD/../../libnao/libnao
 
@@ -1,7 +1,36 @@
 #include "NMain.h"
+#include "NDaemon.h"
 #include <QApplication>
 
+#include <cstdio>
+
 int main(int argc, char *argv[]) {
+
+	// the daemon and its client run headless
+
+	if (argc > 1 && (qstrcmp(argv[1], "--daemon") == 0 || qstrcmp(argv[1], "--submit") == 0)) {
+		QCoreApplication a(argc, argv);
+		QStringList args = a.arguments();
+
+		if (args.at(1) == "--submit") {
+			if (args.size() < 3) {
+				fprintf(stderr, "Usage: %s --submit <json request> [name]\n", argv[0]);
+				return 2;
+			}
+
+			return NDaemon::submit(args.at(2), args.value(3, NDaemon::defaultName()));
+		}
+
+		NDaemon daemon;
+
+		if (!daemon.start(args.value(2, NDaemon::defaultName()))) {
+			fprintf(stderr, "Could not listen on %s: %s\n", qPrintable(args.value(2, NDaemon::defaultName())), qPrintable(daemon.errorString()));
+			return 1;
+		}
+
+		return a.exec();
+	}
+
 	QApplication a(argc, argv);
 	NMain w;
 	w.show();
@@ -0,0 +1,279 @@
+#ifndef NTESTARCHIVES_H
+#define NTESTARCHIVES_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QtEndian>
+
+#include "NUTFBuilder.h"
+#include "NUTFTable.h"
+#include "NUTFSchema.h"
+#include "NCRILAYLA.h"
+
+// small synthetic archives in the layouts the writers expect, and readers that take
+// them apart again without going through libnao
+
+struct NTestEntry {
+    QByteArray dir;     // cpk only
+    QByteArray name;
+    QByteArray data;
+    bool compress;      // cpk only, falls back to stored if it doesn't shrink
+};
+
+namespace NTestArchives {
+    inline QByteArray le32(quint32 value) {
+        QByteArray result(4, '\0');
+        qToLittleEndian<quint32>(value, reinterpret_cast<uchar*>(result.data()));
+        return result;
+    }
+
+    inline QByteArray le64(quint64 value) {
+        QByteArray result(8, '\0');
+        qToLittleEndian<quint64>(value, reinterpret_cast<uchar*>(result.data()));
+        return result;
+    }
+
+    inline void padTo(QByteArray& data, int alignment, char fill = '\0') {
+        while (data.size() % alignment)
+            data += fill;
+    }
+
+    // compressible but not trivially so
+
+    inline QByteArray text(int size, int seed = 0) {
+        static const char* const words[] = { "nier ", "automata ", "pod ", "042 ", "153 ", "yorha ", "2b ", "9s ", "a2 " };
+        QByteArray result;
+        quint32 state = 0x9E3779B9u ^ static_cast<quint32>(seed);
+
+        while (result.size() < size) {
+            state = state * 1664525u + 1013904223u;
+            result += words[(state >> 16) % 9];
+        }
+
+        return result.left(size);
+    }
+
+    inline QByteArray noise(int size, int seed = 0) {
+        QByteArray result(size, '\0');
+        quint32 state = 0x2545F491u ^ static_cast<quint32>(seed);
+
+        for (int i = 0; i < size; ++i) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            result[i] = static_cast<char>(state & 0xFF);
+        }
+
+        return result;
+    }
+
+    // PlatinumGames .dat: header, offset/extension/name/size tables, entries aligned to 0x10
+
+    inline QByteArray makeDAT(const QVector<NTestEntry>& entries) {
+        const quint32 count = static_cast<quint32>(entries.size());
+        int nameLength = 1;
+
+        for (const NTestEntry& e : entries)
+            nameLength = qMax(nameLength, e.name.size() + 1);
+
+        const quint32 offsetsTable = 0x20;
+        const quint32 extensionsTable = offsetsTable + 4 * count;
+        const quint32 namesTable = extensionsTable + 4 * count;
+        const quint32 sizesTable = namesTable + 4 + count * static_cast<quint32>(nameLength);
+
+        QByteArray extensions;
+        QByteArray names = le32(static_cast<quint32>(nameLength));
+        QByteArray sizes;
+
+        for (const NTestEntry& e : entries) {
+            QByteArray extension = e.name.mid(e.name.lastIndexOf('.') + 1).left(3);
+
+            extensions += extension + QByteArray(4 - extension.size(), '\0');
+            names += e.name + QByteArray(nameLength - e.name.size(), '\0');
+            sizes += le32(static_cast<quint32>(e.data.size()));
+        }
+
+        QByteArray content;
+        QByteArray offsets;
+        const int contentStart = ((sizesTable + 4 * count + 0xF) / 0x10) * 0x10;
+
+        for (const NTestEntry& e : entries) {
+            offsets += le32(static_cast<quint32>(contentStart + content.size()));
+            content += e.data;
+            padTo(content, 0x10);
+        }
+
+        QByteArray result = "DAT" + QByteArray(1, '\0') + le32(count) + le32(offsetsTable) +
+                le32(extensionsTable) + le32(namesTable) + le32(sizesTable) + le32(0) + le32(0);
+
+        result += offsets + extensions + names + sizes;
+        padTo(result, 0x10);
+
+        return result + content;
+    }
+
+    inline QVector<QByteArray> readDAT(const QByteArray& archive) {
+        QVector<QByteArray> result;
+        const uchar* p = reinterpret_cast<const uchar*>(archive.constData());
+
+        if (archive.size() < 0x20 || !archive.startsWith("DAT"))
+            return result;
+
+        const quint32 count = qFromLittleEndian<quint32>(p + 4);
+        const quint32 offsetsTable = qFromLittleEndian<quint32>(p + 8);
+        const quint32 sizesTable = qFromLittleEndian<quint32>(p + 20);
+
+        for (quint32 i = 0; i < count; ++i) {
+            result.append(archive.mid(static_cast<int>(qFromLittleEndian<quint32>(p + offsetsTable + 4 * i)),
+                                      static_cast<int>(qFromLittleEndian<quint32>(p + sizesTable + 4 * i))));
+        }
+
+        return result;
+    }
+
+    // CRIWare .cpk: header chunk, TOC chunk at 0x800, aligned content and an ETOC chunk
+    // after it, so moving entries also has to move what follows them
+
+    inline QByteArray chunk(const char* magic, const QByteArray& table) {
+        return QByteArray(magic, 4) + QByteArray(4, '\xFF') + le64(static_cast<quint64>(table.size())) + table;
+    }
+
+    inline QByteArray cpkTOC(const QVector<NTestEntry>& entries, const QVector<QByteArray>& stored,
+                             const QVector<qint64>& offsets) {
+        NUTFBuilder toc("CpkTocInfo");
+
+        toc.addColumn("DirName", NUTFTable::String);
+        toc.addColumn("FileName", NUTFTable::String);
+        toc.addColumn("FileSize", NUTFTable::UInt32);
+        toc.addColumn("ExtractSize", NUTFTable::UInt32);
+        toc.addColumn("FileOffset", NUTFTable::UInt64);
+        toc.addColumn("Info", NUTFTable::UInt32, NUTFTable::Constant, 0);
+        toc.addColumn("ID", NUTFTable::UInt32);
+        toc.addColumn("UserString", NUTFTable::String, NUTFTable::Constant, QByteArray("<NULL>"));
+
+        for (int i = 0; i < entries.size(); ++i) {
+            toc.addRow({ entries.at(i).dir, entries.at(i).name, stored.at(i).size(), entries.at(i).data.size(),
+                         offsets.value(i), i });
+        }
+
+        return chunk("TOC ", toc.build());
+    }
+
+    inline QByteArray cpkHeader(qint64 contentOffset, qint64 contentSize, qint64 tocOffset, qint64 tocSize,
+                                qint64 etocOffset, qint64 etocSize, qint64 itocOffset,
+                                qint64 packed, qint64 extracted, int files) {
+        NUTFBuilder header("CpkHeader");
+
+        header.addColumn("UpdateDateTime", NUTFTable::UInt64, NUTFTable::Constant, 1);
+        header.addColumn("ContentOffset", NUTFTable::UInt64);
+        header.addColumn("ContentSize", NUTFTable::UInt64);
+        header.addColumn("TocOffset", NUTFTable::UInt64);
+        header.addColumn("TocSize", NUTFTable::UInt64);
+        header.addColumn("EtocOffset", NUTFTable::UInt64);
+        header.addColumn("EtocSize", NUTFTable::UInt64);
+        header.addColumn("ItocOffset", NUTFTable::UInt64);
+        header.addColumn("EnabledPackedSize", NUTFTable::UInt64);
+        header.addColumn("EnabledDataSize", NUTFTable::UInt64);
+        header.addColumn("Files", NUTFTable::UInt32);
+        header.addColumn("Align", NUTFTable::UInt16);
+
+        header.addRow({ contentOffset, contentSize, tocOffset, tocSize, etocOffset, etocSize, itocOffset,
+                        packed, extracted, files, 0x800 });
+
+        return chunk("CPK ", header.build());
+    }
+
+    // an ITOC only shows up in the header, there's no table behind it
+
+    inline QByteArray makeCPK(const QVector<NTestEntry>& entries, bool itoc = false) {
+        const qint64 align = 0x800;
+        const qint64 tocOffset = 0x800;
+
+        QVector<QByteArray> stored;
+        qint64 packed = 0;
+        qint64 extracted = 0;
+
+        for (const NTestEntry& e : entries) {
+            QByteArray compressed = e.compress ? NCRILAYLA::compress(e.data) : QByteArray();
+
+            stored.append(compressed.isEmpty() ? e.data : compressed);
+            packed += stored.last().size();
+            extracted += e.data.size();
+        }
+
+        // the TOC has the same size whatever the offsets are, so lay out the content around it
+
+        const qint64 tocSize = cpkTOC(entries, stored, QVector<qint64>()).size();
+        const qint64 contentOffset = ((tocOffset + tocSize + align - 1) / align) * align;
+
+        QByteArray content;
+        QVector<qint64> offsets;
+
+        for (const QByteArray& s : stored) {
+            offsets.append(contentOffset + content.size() - tocOffset);
+            content += s;
+            padTo(content, static_cast<int>(align));
+        }
+
+        NUTFBuilder etoc("CpkEtocInfo");
+        etoc.addColumn("UpdateDateTime", NUTFTable::UInt64);
+        etoc.addColumn("LocalDir", NUTFTable::String);
+
+        for (const NTestEntry& e : entries)
+            etoc.addRow({ 2, e.dir });
+
+        const QByteArray etocChunk = chunk("ETOC", etoc.build());
+        const qint64 etocOffset = contentOffset + content.size();
+
+        QByteArray result = cpkHeader(contentOffset, content.size(), tocOffset, tocSize,
+                                      etocOffset, etocChunk.size(), itoc ? etocOffset : 0,
+                                      packed, extracted, entries.size());
+
+        result += QByteArray(static_cast<int>(tocOffset - 6 - result.size()), '\0');
+        result += "(c)CRI";
+
+        result += cpkTOC(entries, stored, offsets);
+        padTo(result, static_cast<int>(align));
+
+        return result + content + etocChunk;
+    }
+
+    // a chunk's @UTF table, or an invalid one
+
+    inline NUTFTable readChunk(const QByteArray& archive, qint64 offset, const char* magic) {
+        if (offset < 0 || offset + 0x10 > archive.size() || !archive.mid(static_cast<int>(offset), 4).startsWith(magic))
+            return NUTFTable(QByteArray());
+
+        quint64 size = qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(archive.constData()) + offset + 8);
+
+        return NUTFTable(archive.mid(static_cast<int>(offset + 0x10), static_cast<int>(size)));
+    }
+
+    // every entry's stored bytes, in TOC order
+
+    inline QVector<QByteArray> readCPK(const QByteArray& archive, QVector<NTOCRow>* rows = nullptr) {
+        QVector<QByteArray> result;
+        QVector<NTOCRow> toc;
+        NUTFTable header = readChunk(archive, 0, "CPK ");
+
+        if (!header.isValid())
+            return result;
+
+        const qint64 tocOffset = header.value(0, "TocOffset").toLongLong();
+        const qint64 contentOffset = header.value(0, "ContentOffset").toLongLong();
+        const qint64 base = qMin(tocOffset, contentOffset);
+
+        if (!NTOCSchema::read(readChunk(archive, tocOffset, "TOC "), toc))
+            return result;
+
+        for (const NTOCRow& row : toc)
+            result.append(archive.mid(static_cast<int>(base + row.fileOffset), static_cast<int>(row.fileSize)));
+
+        if (rows)
+            *rows = toc;
+
+        return result;
+    }
+}
+
+#endif // NTESTARCHIVES_H
@@ -0,0 +1,117 @@
+#ifndef NUTFBUILDER_H
+#define NUTFBUILDER_H
+
+#include <QByteArray>
+#include <QVariant>
+#include <QVector>
+#include <QtEndian>
+
+#include "NUTFTable.h"
+
+// builds @UTF tables for the tests, laid out the way NUTFTable expects them.
+// only integer and string columns, which is all CPK headers and TOCs need.
+
+class NUTFBuilder {
+    public:
+        explicit NUTFBuilder(const QByteArray& name) : tableName(name) {}
+
+        // per-row columns take their values from addRow(), in the order they were added
+
+        void addColumn(const QByteArray& name, NUTFTable::Type type,
+                       NUTFTable::Storage storage = NUTFTable::PerRow, const QVariant& constant = QVariant()) {
+            columns.append({ name, type, storage, constant });
+        }
+
+        void addRow(const QVector<QVariant>& values) {
+            rows.append(values);
+        }
+
+        QByteArray build() const {
+            QByteArray strings("<NULL>", 7);
+            int nameOffset = addString(strings, tableName);
+
+            QByteArray schema;
+            int rowLength = 0;
+
+            for (const ColumnSpec& c : columns) {
+                QByteArray flags(1, static_cast<char>(c.type | c.storage));
+
+                schema += flags + integer(addString(strings, c.name), 4);
+
+                if (c.storage == NUTFTable::Constant || c.storage == NUTFTable::Constant2)
+                    schema += cell(strings, c.type, c.constant);
+                else if (c.storage == NUTFTable::PerRow)
+                    rowLength += NUTFTable::typeSize(c.type);
+            }
+
+            QByteArray rowData;
+
+            for (const QVector<QVariant>& row : rows) {
+                int value = 0;
+
+                for (const ColumnSpec& c : columns) {
+                    if (c.storage == NUTFTable::PerRow)
+                        rowData += cell(strings, c.type, row.at(value++));
+                }
+            }
+
+            // every offset in the header counts from the byte after the table size
+
+            const int rowsOffset = 0x20 + schema.size();
+            const int stringsOffset = rowsOffset + rowData.size();
+            const int dataOffset = stringsOffset + strings.size();
+
+            QByteArray table = "@UTF" +
+                    integer(dataOffset - 8, 4) +
+                    integer(1, 2) + integer(rowsOffset - 8, 2) +
+                    integer(stringsOffset - 8, 4) +
+                    integer(dataOffset - 8, 4) +
+                    integer(nameOffset, 4) +
+                    integer(columns.size(), 2) +
+                    integer(rowLength, 2) +
+                    integer(rows.size(), 4);
+
+            return table + schema + rowData + strings;
+        }
+
+        // big-endian, as everything in @UTF tables
+
+        static QByteArray integer(quint64 value, int size) {
+            QByteArray result(size, '\0');
+
+            for (int i = size - 1; i >= 0; --i, value >>= 8)
+                result[i] = static_cast<char>(value & 0xFF);
+
+            return result;
+        }
+
+    private:
+        struct ColumnSpec {
+            QByteArray name;
+            NUTFTable::Type type;
+            NUTFTable::Storage storage;
+            QVariant constant;
+        };
+
+        static int addString(QByteArray& strings, const QByteArray& string) {
+            int offset = strings.size();
+
+            strings += string;
+            strings += '\0';
+
+            return offset;
+        }
+
+        static QByteArray cell(QByteArray& strings, NUTFTable::Type type, const QVariant& value) {
+            if (type == NUTFTable::String)
+                return integer(addString(strings, value.toByteArray()), 4);
+
+            return integer(value.toULongLong(), NUTFTable::typeSize(type));
+        }
+
+        QByteArray tableName;
+        QVector<ColumnSpec> columns;
+        QVector<QVector<QVariant>> rows;
+};
+
+#endif // NUTFBUILDER_H
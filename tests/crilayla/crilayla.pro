@@ -0,0 +1,13 @@
+include(../tests.pri)
+
+TARGET = tst_crilayla
+
+SOURCES += \
+        tst_crilayla.cpp \
+        $$NAO/NUTFTable.cpp \
+        $$NAO/NCRILAYLA.cpp
+
+HEADERS += \
+        $$NAO/NUTFTable.h \
+        $$NAO/NUTFSchema.h \
+        $$NAO/NCRILAYLA.h
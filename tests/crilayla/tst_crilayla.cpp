@@ -0,0 +1,141 @@
+#include <QtTest>
+
+#include "NCRILAYLA.h"
+#include "NTestArchives.h"
+
+using namespace NTestArchives;
+
+// extraction decodes matched CPK entries with our own decoder, so whatever the encoder
+// produces has to decode to the original, as a whole and in ranges. a fixed stream in
+// the layout other tools read and write checks the decoder against the format itself.
+
+class tst_CRILAYLA : public QObject {
+        Q_OBJECT
+
+    private slots:
+        void roundTrip_data();
+        void roundTrip();
+
+        void ranges_data();
+        void ranges();
+
+        void fixedVector();
+
+        void incompressible();
+        void rejectsGarbage();
+};
+
+void tst_CRILAYLA::roundTrip_data() {
+    QTest::addColumn<QByteArray>("data");
+
+    QTest::newRow("prefix and one run") << QByteArray(0x100, 'p') + QByteArray(0x40, 'z');
+    QTest::newRow("text") << text(0x4000, 2);
+    QTest::newRow("long runs") << QByteArray(0x100, 'x') + QByteArray(0x5000, 'a') + QByteArray(0x3000, 'b');
+    QTest::newRow("repeats out of reach") << text(0x3000, 3) + noise(0x80, 4) + text(0x3000, 3);
+    QTest::newRow("mixed") << text(0x1000, 6) + noise(0x400, 7) + text(0x1000, 6);
+    QTest::newRow("large") << text(1 << 20, 8);
+}
+
+void tst_CRILAYLA::roundTrip() {
+    QFETCH(QByteArray, data);
+
+    QByteArray compressed = NCRILAYLA::compress(data);
+
+    QVERIFY(!compressed.isEmpty());
+    QVERIFY(compressed.size() < data.size());
+    QVERIFY(NCRILAYLA::isCompressed(compressed));
+
+    QCOMPARE(NCRILAYLA::decompressedSize(compressed), qint64(data.size()));
+    QCOMPARE(NCRILAYLA::decompress(compressed), data);
+
+    // the raw prefix is found from the header alone
+
+    qint64 prefix = NCRILAYLA::prefixPosition(compressed.left(NCRILAYLA::HeaderSize));
+
+    QCOMPARE(compressed.mid(static_cast<int>(prefix), NCRILAYLA::PrefixSize), data.left(NCRILAYLA::PrefixSize));
+}
+
+void tst_CRILAYLA::ranges_data() {
+    QTest::addColumn<qint64>("offset");
+    QTest::addColumn<qint64>("length");
+
+    QTest::newRow("start of the prefix") << qint64(0) << qint64(0x10);
+    QTest::newRow("whole prefix") << qint64(0) << qint64(NCRILAYLA::PrefixSize);
+    QTest::newRow("inside the prefix") << qint64(0x20) << qint64(0x30);
+    QTest::newRow("across the prefix") << qint64(0xF0) << qint64(0x40);
+    QTest::newRow("right after the prefix") << qint64(NCRILAYLA::PrefixSize) << qint64(1);
+    QTest::newRow("middle") << qint64(0x1234) << qint64(0x777);
+    QTest::newRow("to the end") << qint64(0x2000) << qint64(-1);
+    QTest::newRow("past the end") << qint64(0x3F00) << qint64(0x1000);
+    QTest::newRow("last byte") << qint64(0x3FFF) << qint64(1);
+}
+
+void tst_CRILAYLA::ranges() {
+    QFETCH(qint64, offset);
+    QFETCH(qint64, length);
+
+    QByteArray data = text(0x4000, 9);
+    QByteArray compressed = NCRILAYLA::compress(data);
+
+    QVERIFY(!compressed.isEmpty());
+    QCOMPARE(NCRILAYLA::decompress(compressed, offset, length),
+             data.mid(static_cast<int>(offset), static_cast<int>(length)));
+}
+
+void tst_CRILAYLA::fixedVector() {
+
+    // assembled bit by bit following the CriPakTools decoder: literals, a 13-bit distance,
+    // every length level including the 8-bit extension, read back to front from before the
+    // raw prefix. the header holds the decoded size without the prefix and the stream size
+
+    const QByteArray stream(
+            "\x43\x52\x49\x4c\x41\x59\x4c\x41\x58\x01\x00\x00\x16\x00\x00\x00"
+            "\x18\x22\x25\x09\x08\xfa\x01\x40\x3c\x79\xfc\xff\x07\x00\xf5\xe8"
+            "\xd1\x13\xa2\x8c\x1b\x32", 0x26);
+
+    QByteArray prefix(NCRILAYLA::PrefixSize, '\0');
+
+    for (int i = 0; i < prefix.size(); ++i)
+        prefix[i] = static_cast<char>(i);
+
+    QByteArray expected = prefix + "CRI ";
+
+    for (int i = 0; i < 12; ++i)
+        expected += "xyz";
+
+    expected += QByteArray(300, 'z') + "!end";
+
+    QByteArray compressed = stream + prefix;
+
+    QVERIFY(NCRILAYLA::isCompressed(compressed));
+    QCOMPARE(NCRILAYLA::decompressedSize(compressed), qint64(expected.size()));
+    QCOMPARE(NCRILAYLA::decompress(compressed), expected);
+    QCOMPARE(NCRILAYLA::decompress(compressed, 0x120, 0x30), expected.mid(0x120, 0x30));
+}
+
+void tst_CRILAYLA::incompressible() {
+
+    // not worth it (or too short to even try), the writer stores these raw
+
+    QVERIFY(NCRILAYLA::compress(noise(0x2000, 10)).isEmpty());
+    QVERIFY(NCRILAYLA::compress(text(0x100, 11)).isEmpty());
+    QVERIFY(NCRILAYLA::compress(QByteArray()).isEmpty());
+}
+
+void tst_CRILAYLA::rejectsGarbage() {
+    QByteArray compressed = NCRILAYLA::compress(text(0x4000, 12));
+
+    QVERIFY(NCRILAYLA::decompress(text(0x4000, 12)).isEmpty());
+    QVERIFY(NCRILAYLA::decompress(compressed.left(compressed.size() / 2)).isEmpty());
+
+    // a stream that claims more output than it holds runs out of bits
+
+    QByteArray truncated = compressed;
+    qToLittleEndian<quint32>(0x10000, reinterpret_cast<uchar*>(truncated.data()) + 8);
+
+    QVERIFY(NCRILAYLA::decompress(truncated).isEmpty());
+}
+
+QTEST_GUILESS_MAIN(tst_CRILAYLA)
+
+#include "tst_crilayla.moc"
@@ -0,0 +1,21 @@
+include(../tests.pri)
+
+TARGET = tst_repack
+
+SOURCES += \
+        tst_repack.cpp \
+        $$NAO/NArchiveWriter.cpp \
+        $$NAO/NDATWriter.cpp \
+        $$NAO/NCPKWriter.cpp \
+        $$NAO/NUTFTable.cpp \
+        $$NAO/NCRILAYLA.cpp \
+        $$NAO/NTrace.cpp
+
+HEADERS += \
+        $$NAO/NArchiveWriter.h \
+        $$NAO/NDATWriter.h \
+        $$NAO/NCPKWriter.h \
+        $$NAO/NUTFTable.h \
+        $$NAO/NUTFSchema.h \
+        $$NAO/NCRILAYLA.h \
+        $$NAO/NTrace.h
@@ -0,0 +1,228 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QFile>
+
+#include "NDATWriter.h"
+#include "NCPKWriter.h"
+#include "NTestArchives.h"
+
+using namespace NTestArchives;
+
+// an archive written without replacements must come out byte-for-byte identical,
+// and replacing entries must leave every other entry (and what follows them) intact
+
+class tst_Repack : public QObject {
+        Q_OBJECT
+
+    private slots:
+        void initTestCase();
+
+        void unmodifiedDAT();
+        void identicalReplacementDAT();
+        void replacedDAT();
+
+        void unmodifiedCPK();
+        void identicalReplacementCPK();
+        void replacedCPK();
+
+        void refusesUnknownEntries();
+        void refusesIndexedArchives();
+
+    private:
+        QString save(const QString& name, const QByteArray& data);
+        QByteArray load(const QString& name);
+
+        QTemporaryDir dir;
+
+        QVector<NTestEntry> datEntries;
+        QVector<NTestEntry> cpkEntries;
+};
+
+void tst_Repack::initTestCase() {
+    QVERIFY(dir.isValid());
+
+    datEntries = {
+        { "", "model.wmb", text(3000, 1), false },
+        { "", "empty.bin", QByteArray(), false },
+        { "", "texture.wtp", noise(5001, 2), false },
+        { "", "b.bxm", text(17, 3), false }
+    };
+
+    cpkEntries = {
+        { "core", "boot.dat", text(0x3000, 4), true },
+        { "core", "noise.bin", noise(0x1234, 5), true },     // doesn't shrink, stays stored
+        { "", "readme.txt", text(0x90, 6), false },
+        { "sound/bgm", "title.wem", noise(0x2100, 7), false },
+        { "core", "font.ktb", text(0x801, 8), true }
+    };
+}
+
+QString tst_Repack::save(const QString& name, const QByteArray& data) {
+    QString path = dir.filePath(name);
+    QFile file(path);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(data) != data.size())
+        return QString();
+
+    return path;
+}
+
+QByteArray tst_Repack::load(const QString& name) {
+    QFile file(dir.filePath(name));
+
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+void tst_Repack::unmodifiedDAT() {
+    QByteArray original = makeDAT(datEntries);
+    NDATWriter writer(save("original.dat", original));
+
+    QVERIFY2(writer.write(dir.filePath("unmodified.dat")), qPrintable(writer.errorString()));
+    QCOMPARE(load("unmodified.dat"), original);
+}
+
+void tst_Repack::identicalReplacementDAT() {
+    QByteArray original = makeDAT(datEntries);
+    NDATWriter writer(save("original.dat", original));
+
+    // same contents through the replacement path
+
+    writer.replaceFile("model.wmb", save("model.wmb", datEntries.at(0).data));
+
+    QVERIFY2(writer.write(dir.filePath("identical.dat")), qPrintable(writer.errorString()));
+    QCOMPARE(load("identical.dat"), original);
+}
+
+void tst_Repack::replacedDAT() {
+    QByteArray original = makeDAT(datEntries);
+    QByteArray replacement = text(9000, 9);
+    NDATWriter writer(save("original.dat", original));
+
+    writer.replaceFile("model.wmb", save("model.wmb", replacement));
+    writer.replaceFile("empty.bin", save("empty.bin", "now with data"));
+
+    QVERIFY2(writer.write(dir.filePath("replaced.dat")), qPrintable(writer.errorString()));
+
+    QVector<QByteArray> entries = readDAT(load("replaced.dat"));
+
+    QCOMPARE(entries.size(), datEntries.size());
+    QCOMPARE(entries.at(0), replacement);
+    QCOMPARE(entries.at(1), QByteArray("now with data"));
+    QCOMPARE(entries.at(2), datEntries.at(2).data);
+    QCOMPARE(entries.at(3), datEntries.at(3).data);
+}
+
+void tst_Repack::unmodifiedCPK() {
+    QByteArray original = makeCPK(cpkEntries);
+
+    // make sure the test archive has both kinds of entries
+
+    QVector<NTOCRow> rows;
+    QVector<QByteArray> stored = readCPK(original, &rows);
+
+    QCOMPARE(stored.size(), cpkEntries.size());
+    QVERIFY(rows.at(0).fileSize < rows.at(0).extractSize);
+    QCOMPARE(rows.at(1).fileSize, rows.at(1).extractSize);
+
+    NCPKWriter writer(save("original.cpk", original));
+
+    QVERIFY2(writer.write(dir.filePath("unmodified.cpk")), qPrintable(writer.errorString()));
+    QCOMPARE(load("unmodified.cpk"), original);
+}
+
+void tst_Repack::identicalReplacementCPK() {
+    QByteArray original = makeCPK(cpkEntries);
+    NCPKWriter writer(save("original.cpk", original));
+
+    // a stored entry goes back in as-is
+
+    writer.replaceFile("sound/bgm/title.wem", save("title.wem", cpkEntries.at(3).data));
+
+    QVERIFY2(writer.write(dir.filePath("identical.cpk")), qPrintable(writer.errorString()));
+    QCOMPARE(load("identical.cpk"), original);
+}
+
+void tst_Repack::replacedCPK() {
+    QByteArray original = makeCPK(cpkEntries);
+    QByteArray compressed = text(0x6000, 10);
+    QByteArray stored = noise(0x900, 11);
+    NCPKWriter writer(save("original.cpk", original));
+
+    writer.replaceFile("core/boot.dat", save("boot.dat", compressed));
+    writer.replaceFile("readme.txt", save("readme.txt", stored));
+
+    QVERIFY2(writer.write(dir.filePath("replaced.cpk")), qPrintable(writer.errorString()));
+
+    QByteArray result = load("replaced.cpk");
+    QVector<NTOCRow> rows;
+    QVector<QByteArray> entries = readCPK(result, &rows);
+
+    QCOMPARE(entries.size(), cpkEntries.size());
+
+    // what was compressed is compressed again, what was stored stays stored
+
+    QVERIFY(NCRILAYLA::isCompressed(entries.at(0)));
+    QCOMPARE(rows.at(0).extractSize, qint64(compressed.size()));
+    QCOMPARE(NCRILAYLA::decompress(entries.at(0)), compressed);
+
+    QCOMPARE(entries.at(2), stored);
+    QCOMPARE(rows.at(2).extractSize, qint64(stored.size()));
+
+    QVector<QByteArray> before = readCPK(original);
+
+    QCOMPARE(entries.at(1), before.at(1));
+    QCOMPARE(entries.at(3), before.at(3));
+    QCOMPARE(entries.at(4), before.at(4));
+    QCOMPARE(NCRILAYLA::decompress(entries.at(4)), cpkEntries.at(4).data);
+
+    // the header follows the moved ETOC and the new totals
+
+    NUTFTable header = readChunk(result, 0, "CPK ");
+    qint64 etocOffset = header.value(0, "EtocOffset").toLongLong();
+
+    QVERIFY(readChunk(result, etocOffset, "ETOC").isValid());
+    QCOMPARE(result.mid(static_cast<int>(etocOffset)), original.mid(readChunk(original, 0, "CPK ").value(0, "EtocOffset").toInt()));
+
+    qint64 packed = 0;
+    qint64 extracted = 0;
+
+    for (const NTOCRow& row : rows) {
+        packed += row.fileSize;
+        extracted += row.extractSize;
+    }
+
+    QCOMPARE(header.value(0, "EnabledPackedSize").toLongLong(), packed);
+    QCOMPARE(header.value(0, "EnabledDataSize").toLongLong(), extracted);
+}
+
+void tst_Repack::refusesUnknownEntries() {
+    NCPKWriter writer(save("original.cpk", makeCPK(cpkEntries)));
+
+    writer.replaceFile("core/missing.dat", save("missing.dat", "?"));
+
+    QVERIFY(!writer.write(dir.filePath("unknown.cpk")));
+    QVERIFY(!QFile::exists(dir.filePath("unknown.cpk")));
+}
+
+void tst_Repack::refusesIndexedArchives() {
+    const QByteArray original = makeCPK(cpkEntries, true);
+    const QString path = save("indexed.cpk", original);
+
+    // nothing replaced, nothing that could go stale
+
+    NCPKWriter unmodified(path);
+
+    QVERIFY2(unmodified.write(dir.filePath("indexed-unmodified.cpk")), qPrintable(unmodified.errorString()));
+    QCOMPARE(load("indexed-unmodified.cpk"), original);
+
+    NCPKWriter writer(path);
+
+    writer.replaceFile("core/boot.dat", save("boot.dat", text(0x2000, 9)));
+
+    QVERIFY(!writer.write(dir.filePath("indexed-replaced.cpk")));
+    QVERIFY(!QFile::exists(dir.filePath("indexed-replaced.cpk")));
+}
+
+QTEST_GUILESS_MAIN(tst_Repack)
+
+#include "tst_repack.moc"
@@ -0,0 +1,19 @@
+# shared by every test: they build the sources they test directly, so none of them need libnao
+
+QT       += core concurrent testlib
+QT       -= gui
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+NAO = $$PWD/../Nao
+
+INCLUDEPATH += $$NAO $$PWD/common
+
+HEADERS += \
+        $$PWD/common/NUTFBuilder.h \
+        $$PWD/common/NTestArchives.h
@@ -0,0 +1,11 @@
+include(../tests.pri)
+
+TARGET = tst_tocschema
+
+SOURCES += \
+        tst_tocschema.cpp \
+        $$NAO/NUTFTable.cpp
+
+HEADERS += \
+        $$NAO/NUTFTable.h \
+        $$NAO/NUTFSchema.h
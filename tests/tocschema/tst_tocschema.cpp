@@ -0,0 +1,315 @@
+#include <QtTest>
+
+#include "NUTFBuilder.h"
+#include "NUTFTable.h"
+#include "NUTFSchema.h"
+
+// as many rows as the largest TOCs we've come across
+
+static const int LargeRows = 100000;
+
+// the compiled TOC decoder has to give the same rows as NUTFTable::value(), both when it
+// takes its fast path and when an unexpected layout sends it down the generic one.
+// the benchmarks compare the two on a TOC of LargeRows rows.
+
+class tst_TOCSchema : public QObject {
+        Q_OBJECT
+
+    public:
+        enum Layout {
+            Typical,
+            ConstantDir,
+            NoDir,
+            WideSizes,      // 64-bit FileSize, not what the schema expects
+            ZeroExtractSize
+        };
+
+    private slots:
+        void initTestCase();
+
+        void equivalence_data();
+        void equivalence();
+
+        void rejectsMissingColumns();
+        void rejectsBadStrings();
+        void rejectsHugeRowCount();
+        void writeIntegerRange();
+
+        void specialized();
+        void generic();
+
+    private:
+        static QByteArray buildTOC(Layout layout, const QVector<NTOCRow>& rows);
+
+        // the same rows, read one cell at a time
+
+        static QVector<NTOCRow> readGeneric(const NUTFTable& table);
+
+        QVector<NTOCRow> rows;
+        QByteArray large;
+};
+
+Q_DECLARE_METATYPE(tst_TOCSchema::Layout)
+
+QByteArray tst_TOCSchema::buildTOC(Layout layout, const QVector<NTOCRow>& rows) {
+    NUTFBuilder toc("CpkTocInfo");
+
+    if (layout == ConstantDir)
+        toc.addColumn("DirName", NUTFTable::String, NUTFTable::Constant, QByteArray("common"));
+    else if (layout != NoDir)
+        toc.addColumn("DirName", NUTFTable::String);
+
+    toc.addColumn("FileName", NUTFTable::String);
+    toc.addColumn("FileSize", (layout == WideSizes) ? NUTFTable::UInt64 : NUTFTable::UInt32);
+
+    if (layout == ZeroExtractSize)
+        toc.addColumn("ExtractSize", NUTFTable::UInt32, NUTFTable::Zero);
+    else
+        toc.addColumn("ExtractSize", NUTFTable::UInt32);
+
+    toc.addColumn("FileOffset", NUTFTable::UInt64);
+    toc.addColumn("Info", NUTFTable::UInt32, NUTFTable::Constant, 0);
+    toc.addColumn("ID", NUTFTable::UInt32);
+
+    for (int i = 0; i < rows.size(); ++i) {
+        const NTOCRow& row = rows.at(i);
+        QVector<QVariant> values;
+
+        if (layout != ConstantDir && layout != NoDir)
+            values.append(row.dirName);
+
+        values.append(row.fileName);
+        values.append(row.fileSize);
+
+        if (layout != ZeroExtractSize)
+            values.append(row.extractSize);
+
+        values.append(row.fileOffset);
+        values.append(i);
+
+        toc.addRow(values);
+    }
+
+    return toc.build();
+}
+
+QVector<NTOCRow> tst_TOCSchema::readGeneric(const NUTFTable& table) {
+    QVector<NTOCRow> result(static_cast<int>(table.rowCount()));
+    const int dir = table.columnIndex("DirName");
+
+    for (int i = 0; i < result.size(); ++i) {
+        NTOCRow& row = result[i];
+
+        if (dir >= 0)
+            row.dirName = table.value(i, dir).toByteArray();
+
+        row.fileName = table.value(i, "FileName").toByteArray();
+        row.fileOffset = table.value(i, "FileOffset").toLongLong();
+        row.fileSize = table.value(i, "FileSize").toLongLong();
+        row.extractSize = table.value(i, "ExtractSize").toLongLong();
+    }
+
+    return result;
+}
+
+void tst_TOCSchema::initTestCase() {
+
+    // offsets past 4 GiB, so a truncated 64-bit read shows
+
+    for (int i = 0; i < LargeRows; ++i) {
+        NTOCRow row;
+
+        row.dirName = "dir" + QByteArray::number(i % 37);
+        row.fileName = "file" + QByteArray::number(i) + ".bin";
+        row.fileOffset = (Q_INT64_C(1) << 32) + i * Q_INT64_C(0x800);
+        row.fileSize = (i * 7919) % 100000;
+        row.extractSize = row.fileSize + i % 13;
+
+        rows.append(row);
+    }
+
+    large = buildTOC(Typical, rows);
+}
+
+void tst_TOCSchema::equivalence_data() {
+    QTest::addColumn<Layout>("layout");
+    QTest::addColumn<bool>("fast");
+
+    QTest::newRow("typical") << Typical << true;
+    QTest::newRow("constant dir") << ConstantDir << true;
+    QTest::newRow("no dir") << NoDir << true;
+    QTest::newRow("wide sizes") << WideSizes << false;
+    QTest::newRow("zero extract size") << ZeroExtractSize << false;
+}
+
+void tst_TOCSchema::equivalence() {
+    QFETCH(Layout, layout);
+    QFETCH(bool, fast);
+
+    QVector<NTOCRow> input = rows.mid(0, 1000);
+    NUTFTable table(buildTOC(layout, input));
+    QVector<NTOCRow> decoded;
+    bool specialized = !fast;
+
+    QVERIFY(table.isValid());
+    QVERIFY(NTOCSchema::read(table, decoded, &specialized));
+    QCOMPARE(specialized, fast);
+
+    QVector<NTOCRow> reference = readGeneric(table);
+
+    QCOMPARE(decoded.size(), input.size());
+    QCOMPARE(reference.size(), input.size());
+
+    for (int i = 0; i < input.size(); ++i) {
+        const NTOCRow& d = decoded.at(i);
+        const NTOCRow& r = reference.at(i);
+
+        QCOMPARE(d.dirName, r.dirName);
+        QCOMPARE(d.fileName, r.fileName);
+        QCOMPARE(d.fileOffset, r.fileOffset);
+        QCOMPARE(d.fileSize, r.fileSize);
+        QCOMPARE(d.extractSize, r.extractSize);
+
+        // and both are what went in
+
+        QCOMPARE(d.fileName, input.at(i).fileName);
+        QCOMPARE(d.fileOffset, input.at(i).fileOffset);
+        QCOMPARE(d.fileSize, input.at(i).fileSize);
+        QCOMPARE(d.dirName, (layout == ConstantDir) ? QByteArray("common") :
+                            (layout == NoDir) ? QByteArray() : input.at(i).dirName);
+        QCOMPARE(d.extractSize, (layout == ZeroExtractSize) ? Q_INT64_C(0) : input.at(i).extractSize);
+    }
+}
+
+void tst_TOCSchema::rejectsMissingColumns() {
+    NUTFBuilder toc("CpkTocInfo");
+
+    toc.addColumn("DirName", NUTFTable::String);
+    toc.addColumn("FileName", NUTFTable::String);
+    toc.addColumn("FileSize", NUTFTable::UInt32);
+    toc.addRow({ QByteArray("dir"), QByteArray("name"), 1 });
+
+    QVector<NTOCRow> decoded;
+
+    QVERIFY(!NTOCSchema::read(NUTFTable(toc.build()), decoded));
+    QVERIFY(!NTOCSchema::read(NUTFTable(QByteArray("@UTF")), decoded));
+}
+
+void tst_TOCSchema::rejectsBadStrings() {
+    NUTFBuilder toc("CpkTocInfo");
+
+    toc.addColumn("DirName", NUTFTable::String, NUTFTable::Constant, QByteArray("common"));
+    toc.addColumn("FileName", NUTFTable::String);
+    toc.addRow({ QByteArray("name") });
+
+    const QByteArray good = toc.build();
+    const QByteArray outside = NUTFBuilder::integer(good.size(), 4);
+
+    QVERIFY(NUTFTable(good).isValid());
+
+    // table name, column name, constant and per-row cell each pointing past the end
+
+    QByteArray name(good);
+    name.replace(20, 4, outside);
+
+    QByteArray column(good);
+    column.replace(0x21, 4, outside);
+
+    QByteArray constant(good);
+    constant.replace(0x25, 4, outside);
+
+    QByteArray cell(good);
+    cell.replace(static_cast<int>(NUTFTable(good).cellOffset(0, 1)), 4, outside);
+
+    QVERIFY(!NUTFTable(name).isValid());
+    QVERIFY(!NUTFTable(column).isValid());
+    QVERIFY(!NUTFTable(constant).isValid());
+    QVERIFY(!NUTFTable(cell).isValid());
+
+    // a constant whose value would run into the rows
+
+    QByteArray overlap(good);
+    overlap.replace(10, 2, NUTFBuilder::integer(0x20 + 5 + 2 - 8, 2));
+
+    QVERIFY(!NUTFTable(overlap).isValid());
+
+    // the last string is cut off by the end of the table, not read past it
+
+    QByteArray unterminated(good);
+    unterminated[unterminated.size() - 1] = 'X';
+
+    NUTFTable table(unterminated);
+
+    QVERIFY(table.isValid());
+    QCOMPARE(table.value(0, "FileName").toByteArray(), QByteArray("nameX"));
+}
+
+void tst_TOCSchema::rejectsHugeRowCount() {
+    NUTFBuilder toc("CpkTocInfo");
+
+    // rows of constants take no space, so the table is valid with any row count
+
+    toc.addColumn("DirName", NUTFTable::String, NUTFTable::Constant, QByteArray("common"));
+    toc.addColumn("FileName", NUTFTable::String, NUTFTable::Constant, QByteArray("name"));
+    toc.addColumn("FileSize", NUTFTable::UInt32, NUTFTable::Constant, 1);
+    toc.addColumn("ExtractSize", NUTFTable::UInt32, NUTFTable::Constant, 1);
+    toc.addColumn("FileOffset", NUTFTable::UInt64, NUTFTable::Constant, 0);
+
+    QByteArray data = toc.build();
+    qToBigEndian<quint32>(0x80000000U, reinterpret_cast<uchar*>(data.data()) + 28);
+
+    NUTFTable table(data);
+    QVector<NTOCRow> decoded;
+
+    QVERIFY(table.isValid());
+    QCOMPARE(table.rowCount(), Q_INT64_C(0x80000000));
+    QVERIFY(!NTOCSchema::read(table, decoded));
+}
+
+void tst_TOCSchema::writeIntegerRange() {
+    QByteArray table(8, '\0');
+
+    QVERIFY(NUTFTable::writeInteger(table, 0, NUTFTable::UInt32, Q_UINT64_C(0xFFFFFFFF)));
+    QCOMPARE(table.left(4), QByteArray("\xFF\xFF\xFF\xFF"));
+
+    // a file past 4 GiB doesn't fit a 32-bit FileSize, the cell is left alone
+
+    QVERIFY(!NUTFTable::writeInteger(table, 0, NUTFTable::UInt32, Q_UINT64_C(0x100000000)));
+    QCOMPARE(table.left(4), QByteArray("\xFF\xFF\xFF\xFF"));
+
+    QVERIFY(NUTFTable::writeInteger(table, 0, NUTFTable::Int16, static_cast<quint64>(-32768)));
+    QVERIFY(!NUTFTable::writeInteger(table, 0, NUTFTable::Int16, 32768));
+    QVERIFY(!NUTFTable::writeInteger(table, 0, NUTFTable::UInt8, static_cast<quint64>(-1)));
+    QVERIFY(NUTFTable::writeInteger(table, 0, NUTFTable::UInt64, static_cast<quint64>(-1)));
+    QVERIFY(!NUTFTable::writeInteger(table, 4, NUTFTable::UInt64, 0));
+}
+
+void tst_TOCSchema::specialized() {
+    NUTFTable table(large);
+    QVector<NTOCRow> decoded;
+    bool fast = false;
+
+    QBENCHMARK {
+        NTOCSchema::read(table, decoded, &fast);
+    }
+
+    QVERIFY(fast);
+    QCOMPARE(decoded.size(), LargeRows);
+    QCOMPARE(decoded.last().fileName, rows.last().fileName);
+}
+
+void tst_TOCSchema::generic() {
+    NUTFTable table(large);
+    QVector<NTOCRow> decoded;
+
+    QBENCHMARK {
+        decoded = readGeneric(table);
+    }
+
+    QCOMPARE(decoded.size(), LargeRows);
+    QCOMPARE(decoded.last().fileName, rows.last().fileName);
+}
+
+QTEST_GUILESS_MAIN(tst_TOCSchema)
+
+#include "tst_tocschema.moc"